@@ -0,0 +1,117 @@
+#include "meshcodec.h"
+#include "objloader.h"
+#include "mesh.h"
+#include <tinyobjloader/tiny_obj_loader.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+
+/*
+ * Packed mesh size and decode speed against parsing the OBJ, run from the repo root:
+ *   bench_meshcodec [file.obj] [iterations]
+ */
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double seconds_since(Clock::time_point t0)
+{
+	return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// vertices come back renumbered: the error of each decoded vertex is its distance
+// (largest per axis) to the nearest original, found by scanning outward in x order
+static float maxPositionError(const Mesh &original, const Mesh &decoded)
+{
+	const float *p = original.get_positions(), *q = decoded.get_positions();
+	std::vector<size_t> order(original.get_nverts());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [p](size_t a, size_t b) { return p[3 * a] < p[3 * b]; });
+	float err = 0.f;
+	for (size_t v = 0; v < decoded.get_nverts(); v++)
+	{
+		const float *x = q + 3 * v;
+		size_t mid = std::lower_bound(order.begin(), order.end(), x[0], [p](size_t a, float x0) { return p[3 * a] < x0; }) - order.begin();
+		float best = INFINITY;
+		auto visit = [&](size_t i) {
+			const float *y = p + 3 * order[i];
+			if (fabsf(y[0] - x[0]) >= best)
+				return false;
+			best = std::min(best, std::max(fabsf(y[0] - x[0]), std::max(fabsf(y[1] - x[1]), fabsf(y[2] - x[2]))));
+			return true;
+		};
+		for (size_t i = mid; i < order.size() && visit(i); i++)
+			;
+		for (size_t i = mid; i > 0 && visit(i - 1); i--)
+			;
+		err = std::max(err, best);
+	}
+	return err;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = argc > 1 ? argv[1] : "obj/african_head.obj";
+	int iterations = argc > 2 ? atoi(argv[2]) : 20;
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	Mesh parsed;
+	auto t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		std::vector<tinyobj::material_t> materials;
+		std::string warn, err;
+		tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename, NULL, false);
+		parsed.build(attrib, shapes);
+	}
+	double tinyTime = seconds_since(t0) / iterations;
+
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		load_obj_parallel(filename, attrib, shapes);
+		parsed.build(attrib, shapes);
+	}
+	double parallelTime = seconds_since(t0) / iterations;
+	if (!parsed.get_nverts())
+	{
+		std::cerr << "can't load " << filename << std::endl;
+		return 1;
+	}
+
+	std::vector<unsigned char> packed;
+	t0 = Clock::now();
+	encode_mesh(parsed, packed);
+	double encodeTime = seconds_since(t0);
+
+	// a decode is tens of microseconds: take the fastest of many so scheduling noise stays out
+	Mesh decoded;
+	double decodeTime = INFINITY;
+	for (int i = 0; i < iterations * 50; i++)
+	{
+		t0 = Clock::now();
+		decode_mesh(packed.data(), packed.size(), decoded);
+		decodeTime = std::min(decodeTime, seconds_since(t0));
+	}
+
+	std::ifstream probe(filename, std::ios::binary | std::ios::ate);
+	double objBytes = (double)probe.tellg(), rawBytes = (double)parsed.buffer_size();
+	double mb = 1024. * 1024.;
+	std::cout << filename << ": " << parsed.get_nverts() << " vertices, " << parsed.get_ntriangles() << " triangles" << std::endl;
+	std::cout << "  obj       " << objBytes / 1024. << " KB" << std::endl;
+	std::cout << "  mesh      " << rawBytes / 1024. << " KB  (cache/bundle layout)" << std::endl;
+	std::cout << "  packed    " << packed.size() / 1024. << " KB  " << objBytes / packed.size() << "x smaller than obj, "
+			  << rawBytes / packed.size() << "x smaller than the mesh" << std::endl;
+	std::cout << "  tinyobj LoadObj + build   " << tinyTime * 1e3 << " ms" << std::endl;
+	std::cout << "  parallel parse + build    " << parallelTime * 1e3 << " ms" << std::endl;
+	std::cout << "  encode                    " << encodeTime * 1e3 << " ms" << std::endl;
+	std::cout << "  decode, best run          " << decodeTime * 1e3 << " ms  " << packed.size() / mb / decodeTime << " MB/s in, "
+			  << rawBytes / mb / decodeTime << " MB/s out, " << parallelTime / decodeTime << "x faster than parsing" << std::endl;
+	std::cout << "  max position error        " << maxPositionError(parsed, decoded) << std::endl;
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include "objloader.h"
+#include "mesh.h"
+#include "threadpool.h"
+#include <tinyobjloader/tiny_obj_loader.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * OBJ parse throughput, run from the repo root:
+ *   bench_obj [file.obj] [iterations]
+ * without a file it writes a synthetic grid to bench_input.obj in the working directory
+ */
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double seconds_since(Clock::time_point t0)
+{
+	return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// n x n grid with uvs and normals, alternating quads and triangle pairs, like a scan export,
+// plus one two-corner face per row, which loaders drop
+static void writeGrid(const char *filename, int n)
+{
+	std::ofstream out(filename, std::ios::binary);
+	char line[256];
+	unsigned seed = 1;
+	for (int y = 0; y < n; y++)
+	{
+		for (int x = 0; x < n; x++)
+		{
+			seed = seed * 1103515245u + 12345u;
+			float z = (seed >> 8) / 16777216.f * 2.f - 1.f;
+			snprintf(line, sizeof(line), "v %.6f %.6f %.6f\nvt %.6f %.6f\nvn 0 0 1\n",
+					 x * 2.f / n - 1.f, y * 2.f / n - 1.f, z, (float)x / n, (float)y / n);
+			out << line;
+		}
+		for (int x = 1; y > 0 && x < n; x++)
+		{
+			int a = (y - 1) * n + x, b = a + 1, c = y * n + x + 1, d = y * n + x;
+			if (x % 2)
+				snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, d, d, d);
+			else
+				snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d %d/%d/%d\nf %d/%d/%d %d/%d/%d %d/%d/%d\n", a, a, a, b, b, b, c, c, c, a, a, a, c, c, c, d, d, d);
+			out << line;
+		}
+		if (y > 0)
+		{
+			snprintf(line, sizeof(line), "f %d/%d/%d %d/%d/%d\n", y * n, y * n, y * n, y * n + 1, y * n + 1, y * n + 1);
+			out << line;
+		}
+	}
+}
+
+static void noVertex(void *, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t) {}
+static void noNormal(void *, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t) {}
+static void noTexcoord(void *, tinyobj::real_t, tinyobj::real_t, tinyobj::real_t) {}
+static void noFace(void *, tinyobj::index_t *, int) {}
+
+static void benchParse(const char *filename, int iterations)
+{
+	std::ifstream probe(filename, std::ios::binary | std::ios::ate);
+	double mb = probe.tellg() / (1024. * 1024.);
+
+	tinyobj::attrib_t tinyAttrib;
+	std::vector<tinyobj::shape_t> tinyShapes;
+	auto t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		std::vector<tinyobj::material_t> materials;
+		std::string warn, err;
+		tinyobj::LoadObj(&tinyAttrib, &tinyShapes, &materials, &warn, &err, filename, NULL, false);
+	}
+	double tinyTime = seconds_since(t0) / iterations;
+
+	// tinyobj's tokenizer and number parsing alone, nothing stored
+	tinyobj::callback_t callbacks;
+	callbacks.vertex_cb = noVertex;
+	callbacks.normal_cb = noNormal;
+	callbacks.texcoord_cb = noTexcoord;
+	callbacks.index_cb = noFace;
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		std::ifstream in(filename, std::ios::binary);
+		tinyobj::LoadObjWithCallback(in, callbacks);
+	}
+	double callbackTime = seconds_since(t0) / iterations;
+
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+		load_obj_parallel(filename, attrib, shapes);
+	double parallelTime = seconds_since(t0) / iterations;
+
+	Mesh mesh;
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+		load_obj_streaming(filename, mesh);
+	double streamTime = seconds_since(t0) / iterations;
+
+	bool same = tinyAttrib.vertices == attrib.vertices && tinyAttrib.texcoords == attrib.texcoords &&
+				tinyAttrib.normals == attrib.normals && tinyShapes.size() == shapes.size();
+	for (size_t s = 0; same && s < shapes.size(); s++)
+	{
+		const std::vector<tinyobj::index_t> &a = tinyShapes[s].mesh.indices, &b = shapes[s].mesh.indices;
+		same = a.size() == b.size() && tinyShapes[s].mesh.num_face_vertices == shapes[s].mesh.num_face_vertices;
+		for (size_t k = 0; same && k < a.size(); k++)
+			same = a[k].vertex_index == b[k].vertex_index && a[k].texcoord_index == b[k].texcoord_index && a[k].normal_index == b[k].normal_index;
+	}
+
+	std::cout << "obj parse " << filename << " " << mb << " MB" << std::endl;
+	std::cout << "  tinyobj LoadObj           " << tinyTime * 1e3 << " ms  " << mb / tinyTime << " MB/s" << std::endl;
+	std::cout << "  tinyobj callbacks only    " << callbackTime * 1e3 << " ms  " << mb / callbackTime << " MB/s" << std::endl;
+	std::cout << "  parallel, " << ThreadPool::shared().size() << " threads      " << parallelTime * 1e3 << " ms  " << mb / parallelTime << " MB/s" << std::endl;
+	std::cout << "  streaming into mesh       " << streamTime * 1e3 << " ms  " << mb / streamTime << " MB/s  " << mesh.get_nverts() << " vertices" << std::endl;
+	std::cout << "  parallel output " << (same ? "identical" : "MISMATCH") << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = argc > 1 ? argv[1] : "bench_input.obj";
+	int iterations = argc > 2 ? atoi(argv[2]) : 3;
+	if (argc < 2)
+		writeGrid(filename, 1000);
+	benchParse(filename, iterations);
+	return 0;
+}
@@ -0,0 +1,216 @@
+#include "tgaimage.h"
+#include "tgarle.h"
+#include "threadpool.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <string.h>
+
+/*
+ * TGA codec micro benchmarks, run from the repo root:
+ *   bench_tga [file.tga] [iterations]
+ * the encoder benchmark scribbles over bench_output.tga in the working directory
+ */
+
+typedef std::chrono::high_resolution_clock Clock;
+
+static double seconds_since(Clock::time_point t0)
+{
+	return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+// The decoder TGAImage used before tga_rle_decode: one in.get() per packet, one in.read() per raw pixel.
+static bool legacy_load_rle_data(std::istream &in, unsigned char *data, int width, int height, int bytespp)
+{
+	unsigned long pixelcount = width * height;
+	unsigned long currentpixel = 0;
+	unsigned long currentbyte = 0;
+	TGAColor colorbuffer;
+	do
+	{
+		unsigned char chunkheader = in.get();
+		if (!in.good())
+			return false;
+		if (chunkheader < 128)
+		{
+			chunkheader++;
+			for (int i = 0; i < chunkheader; i++)
+			{
+				in.read((char *)colorbuffer.raw, bytespp);
+				if (!in.good())
+					return false;
+				for (int t = 0; t < bytespp; t++)
+					data[currentbyte++] = colorbuffer.raw[t];
+				currentpixel++;
+				if (currentpixel > pixelcount)
+					return false;
+			}
+		}
+		else
+		{
+			chunkheader -= 127;
+			in.read((char *)colorbuffer.raw, bytespp);
+			if (!in.good())
+				return false;
+			for (int i = 0; i < chunkheader; i++)
+			{
+				for (int t = 0; t < bytespp; t++)
+					data[currentbyte++] = colorbuffer.raw[t];
+				currentpixel++;
+				if (currentpixel > pixelcount)
+					return false;
+			}
+		}
+	} while (currentpixel < pixelcount);
+	return true;
+}
+
+// The encoder TGAImage used before tga_rle_encode: byte loop compares, one put() and write() per packet.
+static bool legacy_unload_rle_data(std::ostream &out, const unsigned char *data, int width, int height, int bytespp)
+{
+	const unsigned char max_chunk_length = 128;
+	unsigned long npixels = width * height;
+	unsigned long curpix = 0;
+	while (curpix < npixels)
+	{
+		unsigned long chunkstart = curpix * bytespp;
+		unsigned long curbyte = curpix * bytespp;
+		unsigned char run_length = 1;
+		bool raw = true;
+		while (curpix + run_length < npixels && run_length < max_chunk_length)
+		{
+			bool succ_eq = true;
+			for (int t = 0; succ_eq && t < bytespp; t++)
+				succ_eq = (data[curbyte + t] == data[curbyte + t + bytespp]);
+			curbyte += bytespp;
+			if (1 == run_length)
+				raw = !succ_eq;
+			if (raw && succ_eq)
+			{
+				run_length--;
+				break;
+			}
+			if (!raw && !succ_eq)
+				break;
+			run_length++;
+		}
+		curpix += run_length;
+		out.put(raw ? run_length - 1 : run_length + 127);
+		out.write((char *)(data + chunkstart), (raw ? run_length * bytespp : bytespp));
+		if (!out.good())
+			return false;
+	}
+	return true;
+}
+
+static void benchRleEncode(const char *filename, const char *outname, int iterations)
+{
+	TGAImage image;
+	if (!image.read_tga_file(filename))
+		return;
+	int width = image.get_width(), height = image.get_height(), bytespp = image.get_bytespp();
+	size_t npixels = (size_t)width * height;
+
+	auto t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		std::ofstream out(outname, std::ios::binary);
+		legacy_unload_rle_data(out, image.buffer(), width, height, bytespp);
+	}
+	double legacyTime = seconds_since(t0) / iterations;
+	std::ifstream in(outname, std::ios::binary | std::ios::ate);
+	size_t legacySize = (size_t)in.tellg();
+
+	std::vector<unsigned char> packets(tga_rle_bound(npixels, bytespp));
+	size_t fastSize = 0;
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		std::ofstream out(outname, std::ios::binary);
+		fastSize = tga_rle_encode(image.buffer(), npixels, bytespp, packets.data());
+		out.write((char *)packets.data(), fastSize);
+	}
+	double fastTime = seconds_since(t0) / iterations;
+
+	std::vector<unsigned char> decoded(npixels * bytespp);
+	bool roundtrip = tga_rle_decode(packets.data(), fastSize, decoded.data(), npixels, bytespp) &&
+					 0 == memcmp(decoded.data(), image.buffer(), decoded.size());
+
+	double mb = npixels * bytespp / (1024. * 1024.);
+	std::cout << "rle encode " << filename << " -> " << outname << std::endl;
+	std::cout << "  legacy stream encoder  " << legacyTime * 1e3 << " ms  " << mb / legacyTime << " MB/s  " << legacySize << " bytes" << std::endl;
+	std::cout << "  buffered encoder       " << fastTime * 1e3 << " ms  " << mb / fastTime << " MB/s  " << fastSize << " bytes" << std::endl;
+	std::cout << "  roundtrip " << (roundtrip ? "identical" : "MISMATCH") << std::endl;
+}
+
+static void benchRleDecode(const char *filename, int iterations)
+{
+	std::ifstream in(filename, std::ios::binary);
+	std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	TGA_Header header;
+	if (file.size() < sizeof(header))
+	{
+		std::cerr << "can't read " << filename << std::endl;
+		return;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+	if (10 != header.datatypecode && 11 != header.datatypecode)
+	{
+		std::cerr << filename << " is not RLE compressed" << std::endl;
+		return;
+	}
+	int width = header.width, height = header.height, bytespp = header.bitsperpixel >> 3;
+	size_t nbytes = (size_t)width * height * bytespp;
+	size_t offset = sizeof(header) + (unsigned char)header.idlength;
+	std::vector<unsigned char> legacy(nbytes), fast(nbytes);
+
+	// both file paths open the file every iteration, like read_tga_file does
+	auto t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		std::ifstream stream(filename, std::ios::binary);
+		stream.seekg(offset);
+		legacy_load_rle_data(stream, legacy.data(), width, height, bytespp);
+	}
+	double legacyTime = seconds_since(t0) / iterations;
+
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+	{
+		std::ifstream stream(filename, std::ios::binary);
+		std::vector<unsigned char> payload(file.size() - offset);
+		stream.seekg(offset);
+		stream.read((char *)payload.data(), payload.size());
+		tga_rle_decode(payload.data(), payload.size(), fast.data(), (size_t)width * height, bytespp);
+	}
+	double fastTime = seconds_since(t0) / iterations;
+
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+		tga_rle_decode(file.data() + offset, file.size() - offset, fast.data(), (size_t)width * height, bytespp);
+	double memTime = seconds_since(t0) / iterations;
+
+	std::vector<unsigned char> parallel(nbytes);
+	t0 = Clock::now();
+	for (int i = 0; i < iterations; i++)
+		tga_rle_decode_parallel(file.data() + offset, file.size() - offset, parallel.data(), (size_t)width * height, bytespp, ThreadPool::shared());
+	double parallelTime = seconds_since(t0) / iterations;
+
+	double mb = nbytes / (1024. * 1024.);
+	std::cout << "rle decode " << filename << " " << width << "x" << height << "/" << bytespp * 8 << std::endl;
+	std::cout << "  legacy stream decoder  " << legacyTime * 1e3 << " ms  " << mb / legacyTime << " MB/s" << std::endl;
+	std::cout << "  slurp + buffer decoder " << fastTime * 1e3 << " ms  " << mb / fastTime << " MB/s" << std::endl;
+	std::cout << "  buffer decoder only    " << memTime * 1e3 << " ms  " << mb / memTime << " MB/s" << std::endl;
+	std::cout << "  parallel, " << ThreadPool::shared().size() << " threads   " << parallelTime * 1e3 << " ms  " << mb / parallelTime << " MB/s" << std::endl;
+	std::cout << "  output " << (legacy == fast && fast == parallel ? "identical" : "MISMATCH") << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = argc > 1 ? argv[1] : "obj/african_head_diffuse.tga";
+	int iterations = argc > 2 ? atoi(argv[2]) : 20;
+	benchRleDecode(filename, iterations);
+	benchRleEncode(filename, "bench_output.tga", iterations);
+	return 0;
+}
@@ -0,0 +1,50 @@
+if not exist .\artifacts\* mkdir .\artifacts
+if not exist .\artifacts\bench\* mkdir .\artifacts\bench
+
+cl ^
+/EHsc ^
+/std:c++17 ^
+/O2 ^
+/I..\ ^
+/I..\deps ^
+/Fo.\artifacts\bench\ ^
+    ..\tgaimage.cpp ^
+    ..\tgarle.cpp ^
+    ..\mappedfile.cpp ^
+    ..\threadpool.cpp ^
+    ..\bench\bench_tga.cpp ^
+/link ^
+/out:.\artifacts\bench_tga.exe
+
+cl ^
+/EHsc ^
+/std:c++17 ^
+/O2 ^
+/I..\ ^
+/I..\deps ^
+/Fo.\artifacts\bench\ ^
+    ..\deps\tinyobjloader\tiny_obj_loader.cc ^
+    ..\mesh.cpp ^
+    ..\objloader.cpp ^
+    ..\mappedfile.cpp ^
+    ..\threadpool.cpp ^
+    ..\bench\bench_obj.cpp ^
+/link ^
+/out:.\artifacts\bench_obj.exe
+
+cl ^
+/EHsc ^
+/std:c++17 ^
+/O2 ^
+/I..\ ^
+/I..\deps ^
+/Fo.\artifacts\bench\ ^
+    ..\deps\tinyobjloader\tiny_obj_loader.cc ^
+    ..\mesh.cpp ^
+    ..\meshcodec.cpp ^
+    ..\objloader.cpp ^
+    ..\mappedfile.cpp ^
+    ..\threadpool.cpp ^
+    ..\bench\bench_meshcodec.cpp ^
+/link ^
+/out:.\artifacts\bench_meshcodec.exe
\ No newline at end of file
@@ -11,6 +11,20 @@ cl ^
 /Fo.\artifacts\obj\ ^
     ..\deps\tinyobjloader\tiny_obj_loader.cc ^
     ..\tgaimage.cpp ^
+    ..\tgarle.cpp ^
+    ..\mappedfile.cpp ^
+    ..\mesh.cpp ^
+    ..\objloader.cpp ^
+    ..\bundle.cpp ^
+    ..\meshcodec.cpp ^
+    ..\quantizedmesh.cpp ^
+    ..\threadpool.cpp ^
+    ..\resample.cpp ^
+    ..\tgastream.cpp ^
+    ..\texturecache.cpp ^
+    ..\pyramid.cpp ^
+    ..\framebuffer.cpp ^
+    ..\framewriter.cpp ^
     ..\main.cpp ^
 /link ^
 /out:.\artifacts\cctr.exe
\ No newline at end of file
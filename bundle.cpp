@@ -0,0 +1,181 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string.h>
+#include "bundle.h"
+#include "mesh.h"
+#include "tgaimage.h"
+
+namespace {
+
+const char BUNDLE_MAGIC[4] = {'C', 'C', 'A', 'B'};
+const uint32_t BUNDLE_VERSION = 1;
+const uint64_t PAGE = 4096; // payload alignment, also a multiple of what Mesh wants
+
+// native byte order like the mesh cache, bundles are baked for the machines that read them
+struct BundleHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t nentries;
+	uint32_t reserved;
+};
+
+uint64_t align_page(uint64_t n) {
+	return (n+PAGE-1) & ~(PAGE-1);
+}
+
+}
+
+AssetBundle::AssetBundle() : entries(NULL), nentries(0) {
+}
+
+bool AssetBundle::open(const char *filename) {
+	close();
+	if (!file.open(filename)) {
+		return false;
+	}
+	BundleHeader header;
+	if (file.size()<sizeof(header)) {
+		std::cerr << "truncated bundle " << filename << "\n";
+		close();
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+	if (memcmp(header.magic, BUNDLE_MAGIC, sizeof(header.magic)) || header.version!=BUNDLE_VERSION
+		|| header.nentries>(file.size()-sizeof(header))/sizeof(Entry)) {
+		std::cerr << "not a bundle or another version: " << filename << "\n";
+		close();
+		return false;
+	}
+	entries = (const Entry *)(file.data()+sizeof(header));
+	nentries = header.nentries;
+	for (uint32_t i=0; i<nentries; i++) {
+		const Entry &e = entries[i];
+		if (e.offset%PAGE || e.offset>file.size() || e.size>file.size()-e.offset || !memchr(e.name, 0, sizeof(e.name))) {
+			std::cerr << "corrupt bundle " << filename << "\n";
+			close();
+			return false;
+		}
+	}
+	// the whole point is the first frame: start reading everything in right away
+	file.prefetch();
+	return true;
+}
+
+void AssetBundle::close() {
+	file.close();
+	entries = NULL;
+	nentries = 0;
+}
+
+const AssetBundle::Entry *AssetBundle::find(const char *name, EntryType type) const {
+	for (uint32_t i=0; i<nentries; i++) {
+		if (entries[i].type==(uint32_t)type && !strcmp(entries[i].name, name)) return &entries[i];
+	}
+	std::cerr << "no " << (type==MESH ? "mesh " : "texture ") << name << " in the bundle\n";
+	return NULL;
+}
+
+bool AssetBundle::get_mesh(const char *name, Mesh &mesh) const {
+	const Entry *e = find(name, MESH);
+	return e && mesh.attach(file.data()+e->offset, (size_t)e->size, (size_t)e->count0, (size_t)e->count1, (int)e->format);
+}
+
+bool AssetBundle::get_texture(const char *name, TGAImage &image) const {
+	const Entry *e = find(name, TEXTURE);
+	if (!e) return false;
+	int bpp = (int)e->format;
+	if ((bpp!=TGAImage::GRAYSCALE && bpp!=TGAImage::RGB && bpp!=TGAImage::RGBA)
+		|| !e->count0 || !e->count1 || e->count0>65535 || e->count1>65535 || e->size!=e->count0*e->count1*bpp) {
+		std::cerr << "bad texture " << name << " in the bundle\n";
+		return false;
+	}
+	image = TGAImage((int)e->count0, (int)e->count1, bpp, file.data()+e->offset);
+	return true;
+}
+
+bool AssetBundleWriter::add_mesh(const char *name, const Mesh &mesh) {
+	if (strlen(name)>=sizeof(((AssetBundle::Entry *)0)->name) || !mesh.get_nverts()) {
+		std::cerr << "can't bundle mesh " << name << "\n";
+		return false;
+	}
+	Item item = {name, &mesh, NULL};
+	items.push_back(item);
+	return true;
+}
+
+bool AssetBundleWriter::add_texture(const char *name, TGAImage &image) {
+	if (strlen(name)>=sizeof(((AssetBundle::Entry *)0)->name) || !image.buffer()) {
+		std::cerr << "can't bundle texture " << name << "\n";
+		return false;
+	}
+	Item item = {name, NULL, &image};
+	items.push_back(item);
+	return true;
+}
+
+bool AssetBundleWriter::write(const char *filename) const {
+	BundleHeader header;
+	memset((void *)&header, 0, sizeof(header));
+	memcpy(header.magic, BUNDLE_MAGIC, sizeof(header.magic));
+	header.version  = BUNDLE_VERSION;
+	header.nentries = (uint32_t)items.size();
+
+	std::vector<AssetBundle::Entry> table(items.size());
+	uint64_t offset = align_page(sizeof(header)+table.size()*sizeof(AssetBundle::Entry));
+	for (size_t i=0; i<items.size(); i++) {
+		AssetBundle::Entry &e = table[i];
+		memset((void *)&e, 0, sizeof(e));
+		memcpy(e.name, items[i].name.c_str(), items[i].name.size()+1);
+		if (items[i].mesh) {
+			const Mesh &mesh = *items[i].mesh;
+			e.type   = AssetBundle::MESH;
+			e.format = (uint32_t)mesh.get_attributes();
+			e.size   = mesh.buffer_size();
+			e.count0 = mesh.get_nverts();
+			e.count1 = mesh.get_nindices();
+		} else {
+			TGAImage &image = *items[i].image;
+			e.type   = AssetBundle::TEXTURE;
+			e.format = (uint32_t)image.get_bytespp();
+			e.count0 = (uint64_t)image.get_width();
+			e.count1 = (uint64_t)image.get_height();
+			e.size   = e.count0*e.count1*e.format;
+		}
+		e.offset = offset;
+		offset = align_page(offset+e.size);
+	}
+
+	// written aside and renamed into place, like the mesh cache
+	std::string tmp = std::string(filename)+".tmp";
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << tmp << "\n";
+		return false;
+	}
+	out.write((char *)&header, sizeof(header));
+	out.write((char *)table.data(), (std::streamsize)(table.size()*sizeof(AssetBundle::Entry)));
+	std::vector<char> zeros(PAGE, 0);
+	uint64_t pos = sizeof(header)+table.size()*sizeof(AssetBundle::Entry);
+	for (size_t i=0; i<items.size() && out.good(); i++) {
+		out.write(zeros.data(), (std::streamsize)(table[i].offset-pos));
+		if (items[i].mesh) {
+			out.write((const char *)items[i].mesh->buffer(), (std::streamsize)table[i].size);
+		} else {
+			// row by row: mapped bottom-up images have a negative stride
+			TGAImage &image = *items[i].image;
+			for (int y=0; y<image.get_height(); y++) {
+				out.write((const char *)image.row(y), (std::streamsize)image.get_width()*image.get_bytespp());
+			}
+		}
+		pos = table[i].offset+table[i].size;
+	}
+	out.close();
+	std::error_code ec;
+	if (!out.good() || (std::filesystem::rename(tmp, filename, ec), ec)) {
+		std::cerr << "can't write the bundle " << filename << "\n";
+		std::filesystem::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
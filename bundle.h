@@ -0,0 +1,64 @@
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "mappedfile.h"
+
+class Mesh;
+class TGAImage;
+
+// One file holding welded meshes and decoded textures, each payload page aligned,
+// so a render job maps it once and points meshes and images straight into it:
+// no parsing, no decoding, no copies, and the OS reads it in with one prefetch.
+class AssetBundle {
+public:
+	enum EntryType {
+		MESH=1, TEXTURE=2
+	};
+#pragma pack(push,1)
+	struct Entry {
+		char name[80];   // NUL terminated, usually the source path
+		uint32_t type;
+		uint32_t format; // MESH: Mesh::Attribute mask, TEXTURE: bytes per pixel
+		uint64_t offset; // from the start of the file
+		uint64_t size;
+		uint64_t count0; // MESH: vertices, TEXTURE: width
+		uint64_t count1; // MESH: indices,  TEXTURE: height, rows top to bottom
+		uint64_t reserved;
+	};
+#pragma pack(pop)
+protected:
+	MappedFile file;
+	const Entry *entries;
+	uint32_t nentries;
+
+	const Entry *find(const char *name, EntryType type) const;
+public:
+	AssetBundle();
+	bool open(const char *filename);
+	void close();
+	// the mesh or image borrows bundle memory and must not outlive the bundle
+	bool get_mesh(const char *name, Mesh &mesh) const;
+	bool get_texture(const char *name, TGAImage &image) const;
+	uint32_t size() const { return nentries; }
+	const Entry &entry(uint32_t i) const { return entries[i]; }
+};
+
+// The offline bake step: collects meshes and textures and lays them out for AssetBundle.
+// Added objects are referenced, not copied, until write().
+class AssetBundleWriter {
+	struct Item {
+		std::string name;
+		const Mesh *mesh;
+		TGAImage *image;
+	};
+	std::vector<Item> items;
+public:
+	bool add_mesh(const char *name, const Mesh &mesh);
+	bool add_texture(const char *name, TGAImage &image);
+	bool write(const char *filename) const;
+};
+
+#endif //__BUNDLE_H__
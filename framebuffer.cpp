@@ -0,0 +1,64 @@
+#include <algorithm>
+#include "framebuffer.h"
+
+Framebuffer::Framebuffer(int w, int h, int bpp) : color(w, h, bpp), zbuffer((size_t)w*h),
+	tiles_x((w+TILE_SIZE-1)/TILE_SIZE), tiles_y((h+TILE_SIZE-1)/TILE_SIZE), clear_depth(0.f), band_y(0), frame_height(h) {
+	// freshly allocated image is zeroed, depth is zeroed, nothing pending
+	tile_cleared.assign((size_t)tiles_x*tiles_y, 0);
+}
+
+void Framebuffer::clear(Pixel32 c, float depth) {
+	clear_color = c;
+	clear_depth = depth;
+	std::fill(tile_cleared.begin(), tile_cleared.end(), 1);
+}
+
+void Framebuffer::set_band(int y0, int height) {
+	band_y = y0;
+	frame_height = height;
+}
+
+void Framebuffer::init_tile(int tx, int ty) {
+	int width = color.get_width();
+	int x0 = tx*TILE_SIZE, x1 = std::min(x0+TILE_SIZE, width);
+	int y0 = ty*TILE_SIZE, y1 = std::min(y0+TILE_SIZE, color.get_height());
+	color.fill_rect(x0, y0, x1-x0, y1-y0, TGAColor(clear_color, color.get_bytespp()));
+	for (int y=y0; y<y1; y++)
+		std::fill(zbuffer.begin()+(size_t)y*width+x0, zbuffer.begin()+(size_t)y*width+x1, clear_depth);
+	tile_cleared[tx+ty*tiles_x] = 0;
+}
+
+// Initializes every pending tile overlapping the inclusive pixel rect [x0,x1]x[y0,y1].
+void Framebuffer::touch(int x0, int y0, int x1, int y1) {
+	if (x1<0 || y1<0 || x1<x0 || y1<y0) return;
+	int tx0 = std::max(x0, 0)/TILE_SIZE, tx1 = std::min(x1/TILE_SIZE, tiles_x-1);
+	int ty0 = std::max(y0, 0)/TILE_SIZE, ty1 = std::min(y1/TILE_SIZE, tiles_y-1);
+	for (int ty=ty0; ty<=ty1; ty++) {
+		for (int tx=tx0; tx<=tx1; tx++) {
+			if (tile_cleared[tx+ty*tiles_x])
+				init_tile(tx, ty);
+		}
+	}
+}
+
+// Emits the clear color into every tile the rasterizer never touched; call before reading image().
+void Framebuffer::resolve() {
+	for (int ty=0; ty<tiles_y; ty++) {
+		for (int tx=0; tx<tiles_x; tx++) {
+			if (tile_cleared[tx+ty*tiles_x])
+				init_tile(tx, ty);
+		}
+	}
+}
+
+// Hands out the resolved color image and continues on a fresh buffer from pool, so the
+// caller can give the frame away (e.g. to a FrameWriter) and render the next one at once.
+// The new buffer is not zeroed, every tile starts pending with the current clear values.
+TGAImage Framebuffer::detach(ImagePool &pool) {
+	resolve();
+	TGAImage frame(std::move(color));
+	color = TGAImage(frame.get_width(), frame.get_height(), frame.get_bytespp(), pool);
+	color.set_origin(frame.get_origin());
+	std::fill(tile_cleared.begin(), tile_cleared.end(), 1);
+	return frame;
+}
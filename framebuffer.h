@@ -0,0 +1,44 @@
+#ifndef __FRAMEBUFFER_H__
+#define __FRAMEBUFFER_H__
+
+#include <vector>
+#include "tgaimage.h"
+
+// Color + depth target with lazy clears. clear() only resets the per-tile
+// "cleared" bits; a tile's pixels are initialized the first time the rasterizer
+// touches it, and tiles nobody touched are filled with the clear color in resolve().
+// It may also hold just a horizontal band of a larger picture, see set_band().
+class Framebuffer {
+protected:
+	TGAImage color;
+	std::vector<float> zbuffer;
+	std::vector<unsigned char> tile_cleared; // 1 = tile still holds stale data, must be initialized before use
+	int tiles_x;
+	int tiles_y;
+	Pixel32 clear_color;
+	float clear_depth;
+	int band_y;       // first row of the whole picture held here
+	int frame_height; // height of the whole picture
+
+	void init_tile(int tx, int ty);
+public:
+	enum { TILE_SIZE = 64 };
+
+	Framebuffer(int w, int h, int bpp);
+	void clear(Pixel32 c, float depth);
+	void touch(int x0, int y0, int x1, int y1);
+	void resolve();
+	TGAImage detach(ImagePool &pool);
+	float *depth(int x, int y) { return &zbuffer[(size_t)y*color.get_width()+x]; }
+	TGAImage &image() { return color; }
+	int get_width() { return color.get_width(); }
+	int get_height() { return color.get_height(); }
+
+	// For pictures rendered band by band: this buffer holds rows [y0, y0+get_height())
+	// of a picture frame_height rows tall. Projection uses the frame, clipping the band.
+	void set_band(int y0, int frame_height);
+	int get_band_y() { return band_y; }
+	int get_frame_height() { return frame_height; }
+};
+
+#endif //__FRAMEBUFFER_H__
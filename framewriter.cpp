@@ -0,0 +1,59 @@
+#include <iostream>
+#include "framewriter.h"
+
+FrameWriter::FrameWriter(size_t max_pending, bool rle, ThreadPool *encoders) : max_pending(max_pending ? max_pending : 1), rle(rle),
+	encoders(encoders), busy(false), stopping(false), failed(false) {
+	worker = std::thread(&FrameWriter::run, this);
+}
+
+FrameWriter::~FrameWriter() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	not_empty.notify_all();
+	worker.join();
+}
+
+void FrameWriter::submit(TGAImage &&frame, const std::string &filename) {
+	std::unique_lock<std::mutex> lock(mtx);
+	not_full.wait(lock, [this]() { return queue.size()<max_pending; });
+	Job job;
+	job.image = std::move(frame);
+	job.filename = filename;
+	queue.push_back(std::move(job));
+	lock.unlock();
+	not_empty.notify_one();
+}
+
+bool FrameWriter::flush() {
+	std::unique_lock<std::mutex> lock(mtx);
+	idle.wait(lock, [this]() { return queue.empty() && !busy; });
+	return !failed;
+}
+
+void FrameWriter::run() {
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			not_empty.wait(lock, [this]() { return stopping || !queue.empty(); });
+			if (queue.empty()) return; // stopping and drained
+			job = std::move(queue.front());
+			queue.pop_front();
+			busy = true;
+		}
+		not_full.notify_one();
+
+		bool ok = job.image.write_tga_file(job.filename.c_str(), rle, encoders);
+		if (!ok) std::cerr << "can't write frame " << job.filename << "\n";
+		job.image = TGAImage(); // hand a pooled buffer back before reporting idle
+
+		{
+			std::lock_guard<std::mutex> lock(mtx);
+			busy = false;
+			if (!ok) failed = true;
+		}
+		idle.notify_all();
+	}
+}
@@ -0,0 +1,45 @@
+#ifndef __FRAMEWRITER_H__
+#define __FRAMEWRITER_H__
+
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "tgaimage.h"
+
+// Encodes and writes frames on a background thread so the caller can render the
+// next frame meanwhile. At most max_pending frames wait in the queue; submit()
+// blocks when it is full, so a slow disk throttles the renderer instead of
+// letting frames pile up in memory.
+class FrameWriter {
+	struct Job {
+		TGAImage image;
+		std::string filename;
+	};
+
+	std::deque<Job> queue;
+	size_t max_pending;
+	bool rle;
+	ThreadPool *encoders;
+	bool busy;     // the writer thread holds a job outside the queue
+	bool stopping;
+	bool failed;
+	std::mutex mtx;
+	std::condition_variable not_full;
+	std::condition_variable not_empty;
+	std::condition_variable idle;
+	std::thread worker;
+
+	void run();
+public:
+	FrameWriter(size_t max_pending=1, bool rle=true, ThreadPool *encoders=NULL);
+	FrameWriter(const FrameWriter &) = delete;
+	FrameWriter & operator =(const FrameWriter &) = delete;
+	~FrameWriter(); // writes whatever is still queued
+
+	void submit(TGAImage &&frame, const std::string &filename); // takes ownership of frame
+	bool flush(); // waits for the queue to drain, false if any write failed so far
+};
+
+#endif //__FRAMEWRITER_H__
@@ -1,35 +1,65 @@
 #include "tgaimage.h"
 #include "geometry.h"
+#include "framebuffer.h"
+#include "framewriter.h"
+#include "mesh.h"
+#include "bundle.h"
+#include "meshcodec.h"
+#include "quantizedmesh.h"
+#include "objloader.h"
+#include "pyramid.h"
+#include "tgastream.h"
+#include "texturecache.h"
 #include <tinyobjloader/tiny_obj_loader.h>
 #include <iostream>
 #include <algorithm>
 #include <limits>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
 const TGAColor green = TGAColor(0, 255, 0, 255);
 
-bool loadModel(tinyobj::attrib_t &attrib, std::vector<tinyobj::shape_t> &shapes, const char *filename, const char *path)
-{
-	std::vector<tinyobj::material_t> mats;
+static bool streamObj = false; // --stream-obj, weld while parsing on one thread to halve peak memory
+static float quantizeError = 0.f; // --quantize ERR, render from 16-bit vertices when they stay within ERR
 
-	std::string warn;
-	std::string err;
+/*
+ * The welded mesh is cached next to the OBJ, later runs map the cache instead of parsing.
+ * attributes lists the Mesh::Attribute arrays the render needs, nothing else is loaded.
+ */
+bool loadMesh(Mesh &mesh, const char *filename, int attributes)
+{
+	// packed meshes from the asset store decode faster than a cache could be mapped and checked
+	size_t length = strlen(filename);
+	if (length > 6 && !strcmp(filename + length - 6, ".meshz"))
+		return read_mesh_packed(filename, mesh);
 
-	// this filepath depends on the working directory
-	// TODO somehow set working directory in some type of single global place...
-	auto loaded = tinyobj::LoadObj(&attrib, &shapes, &mats, &warn, &err,
-								   filename,
-								   path,
-								   true);
+	std::string cachePath = std::string(filename) + ".meshcache";
+	if (mesh.map_cache_file(cachePath.c_str(), filename, attributes))
+		return true;
 
-	if (!warn.empty())
-		std::cout << warn << std::endl;
-	if (!err.empty())
-		std::cout << err << std::endl;
+	if (streamObj)
+	{
+		// a counting pass first, so the streaming parse never regrows an array
+		ObjCounts counts;
+		if (!count_obj(filename, counts, attributes) || !load_obj_streaming(filename, mesh, attributes, &counts))
+			return false;
+	}
+	else
+	{
+		// parsed in parallel on the shared pool
+		tinyobj::attrib_t attrib;
+		std::vector<tinyobj::shape_t> shapes;
+		if (!load_obj_parallel(filename, attrib, shapes, attributes) || !mesh.build(attrib, shapes))
+			return false;
+	}
 
-	return loaded;
+	mesh.write_cache_file(cachePath.c_str(), filename, attributes); // best effort, the render goes on without it
+	return true;
 }
 
 /*
@@ -80,16 +110,20 @@ void line(int x0, int y0, int x1, int y1, TGAImage &frame, const TGAColor &color
 	}
 	else
 	{
+		// a shallow line is a staircase of horizontal runs, write each one as a span
+		int spanStart = x0;
 		for (int x = x0; x <= x1; x++)
 		{
-			frame.set(x, y, color);
 			error += derror;
 			if (error > .5f)
 			{
+				frame.set_span(spanStart, y, x - spanStart + 1, color);
+				spanStart = x + 1;
 				y += correction;
 				error -= dx * 2; // whoah ...
 			}
 		}
+		frame.set_span(spanStart, y, x1 - spanStart + 1, color);
 	}
 }
 
@@ -121,7 +155,8 @@ Vec3f barycentric(Vec3f a, Vec3f b, Vec3f c, Vec3f p)
 	return Vec3f(-1, 1, 1);
 }
 
-void triangle(Vec3f *pts, Vec2f *texCoords, float lightIntensity, float *zbuffer, TGAImage &frame, TGAImage &texture)
+template <class FrameFmt, class TexFmt>
+void triangle(Vec3f *pts, Vec2f *texCoords, float lightIntensity, Framebuffer &frame, ImageView<FrameFmt> color, ImageView<TexFmt> texture)
 {
 	/*
 	 * Vert bounding box
@@ -139,12 +174,18 @@ void triangle(Vec3f *pts, Vec2f *texCoords, float lightIntensity, float *zbuffer
 		}
 	}
 
+	// first touch initializes any lazily cleared tiles under the bbox
+	frame.touch((int)bboxmin.x, (int)bboxmin.y, (int)bboxmax.x, (int)bboxmax.y);
+
 	// you've found point P, what are its texcoords relative to A, B, C?
 	// what are P's texcoords?
+	// the bbox is already clamped to the frame, so walk it row by row through unchecked row pointers
 	Vec3f p;
-	for (p.x = bboxmin.x; p.x <= bboxmax.x; p.x++)
+	for (p.y = bboxmin.y; p.y <= bboxmax.y; p.y++)
 	{
-		for (p.y = bboxmin.y; p.y <= bboxmax.y; p.y++)
+		unsigned char *colorRow = color.row((int)p.y);
+		float *depthRow = frame.depth(0, (int)p.y);
+		for (p.x = bboxmin.x; p.x <= bboxmax.x; p.x++)
 		{
 			Vec3f bcScreen = barycentric(pts[0], pts[1], pts[2], p); // TODO assumes pts.len = 3
 			if (bcScreen.x < 0 || bcScreen.y < 0 || bcScreen.z < 0)
@@ -158,10 +199,10 @@ void triangle(Vec3f *pts, Vec2f *texCoords, float lightIntensity, float *zbuffer
 			}
 
 			// zbuffer ...
-			int zindex = (int)(p.x + p.y * frame.get_width());
-			if (zbuffer[zindex] < p.z)
+			float *depth = depthRow + (int)p.x;
+			if (*depth < p.z)
 			{
-				zbuffer[zindex] = p.z;
+				*depth = p.z;
 
 				// float u = (texCoords[0].x * bcScreen.x) + (texCoords[1].x * bcScreen.y) + (texCoords[2].x * bcScreen.z);
 				// float v = (texCoords[0].y * bcScreen.x) + (texCoords[1].y * bcScreen.y) + (texCoords[2].y * bcScreen.z);
@@ -169,88 +210,295 @@ void triangle(Vec3f *pts, Vec2f *texCoords, float lightIntensity, float *zbuffer
 				for (int i = 0; i < 3; i++) u += texCoords[i].x * bcScreen[i];
 				for (int i = 0; i < 3; i++) v += texCoords[i].y * bcScreen[i];
 
-				auto color = texture.get(u * texture.get_width(), (1 - v) * texture.get_height());
-				color.r *= lightIntensity;
-				color.g *= lightIntensity;
-				color.b *= lightIntensity;
-				frame.set(p.x, p.y, color);
+				Pixel32 texel = texture.get(u * texture.get_width(), (1 - v) * texture.get_height());
+				FrameFmt::store(colorRow + (int)p.x * FrameFmt::bytespp, texel.scaled(lightIntensity));
 			}
 		}
 	}
 }
 
-void triangleRaster(const char *objFilePath, const char *objBasePath, const char *texturePath, TGAImage &frame)
+// vertex fetch, one overload per mesh layout the rasterizer is instantiated for
+static Vec3f vertexPosition(const Mesh &mesh, size_t index)
 {
-	int frameWidth = frame.get_width(), frameHeight = frame.get_height();
+	const float *p = mesh.get_positions() + 3 * index;
+	return Vec3f(p[0], p[1], p[2]);
+}
 
-	int zlen = frameWidth * frameHeight;
-	float *zbuffer = new float[zlen];
-	std::fill(zbuffer, zbuffer + zlen, -std::numeric_limits<float>::max());
+static Vec3f vertexPosition(const QuantizedMesh &mesh, size_t index)
+{
+	float p[4];
+	mesh.get_position(index, p);
+	return Vec3f(p[0], p[1], p[2]);
+}
 
-	TGAImage texture;
-	if (!texture.read_tga_file("obj/african_head_diffuse.tga"))
-		std::cout << "Unable to read " << texturePath << std::endl;
+static Vec2f vertexTexcoord(const Mesh &mesh, size_t index)
+{
+	const float *uvs = mesh.get_texcoords();
+	return uvs ? Vec2f(uvs[2 * index + 0], uvs[2 * index + 1]) : Vec2f(0.f, 0.f);
+}
 
-	// int texWidth = texture.get_width(), texHeight = texture.get_height();
+static Vec2f vertexTexcoord(const QuantizedMesh &mesh, size_t index)
+{
+	if (!(mesh.get_attributes() & Mesh::TEXCOORDS))
+		return Vec2f(0.f, 0.f);
+	float uv[2];
+	mesh.get_texcoord(index, uv);
+	return Vec2f(uv[0], uv[1]);
+}
 
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	loadModel(attrib, shapes, objFilePath, objBasePath);
+template <class Model, class FrameFmt, class TexFmt>
+void rasterizeModel(const Model &mesh, Framebuffer &frame, ImageView<FrameFmt> color, ImageView<TexFmt> texture)
+{
+	// project onto the whole picture, then shift into the band the framebuffer holds
+	int frameWidth = frame.get_width(), frameHeight = frame.get_frame_height();
+	float bandY = frame.get_band_y();
 
-	for (auto ishape = 0; ishape < shapes.size(); ishape++)
+	const uint32_t *indices = mesh.get_indices();
+	for (size_t itri = 0; itri < mesh.get_ntriangles(); itri++)
 	{
-		auto shape = shapes[ishape];
-		size_t faceOffset = 0;
-		for (auto iface = 0; iface < shape.mesh.num_face_vertices.size(); iface++)
+		Vec3f worldCoords[3];
+		Vec3f screenCoords[3];
+		Vec2f texCoords[3];
+
+		for (int ivert = 0; ivert < 3; ivert++)
 		{
-			// TODO use numVerts
-			Vec3f worldCoords[3];
-			Vec3f screenCoords[3];
-			Vec2f texCoords[3];
+			// welded vertices share one index for position and uv
+			size_t index = indices[3 * itri + ivert];
+			worldCoords[ivert] = vertexPosition(mesh, index);
+			float x = worldCoords[ivert].x, y = worldCoords[ivert].y, z = worldCoords[ivert].z;
+			// world to screen coords
+			screenCoords[ivert] = Vec3f((int)((x + 1.f) * frameWidth / 2.f + .5f), (int)((y + 1.f) * frameHeight / 2.f + .5f) - bandY, z);
+
+			texCoords[ivert] = vertexTexcoord(mesh, index);
+		}
 
-			auto numVerts = shape.mesh.num_face_vertices[iface];
-			for (auto ivert = 0; ivert < numVerts; ivert++)
-			{
-				// face has n verts, vert has 3 'points'
-				auto face = shape.mesh.indices[faceOffset + ivert];
-				auto x = attrib.vertices[3 * face.vertex_index + 0]; // 3 as in obj file format or 3 as in vertices?
-				auto y = attrib.vertices[3 * face.vertex_index + 1];
-				auto z = attrib.vertices[3 * face.vertex_index + 2];
+		// illumination
+		Vec3f normal = (worldCoords[2] - worldCoords[0]) ^ (worldCoords[1] - worldCoords[0]);
+		normal.normalize();
+		float intensity = normal * Vec3f(0, 0, -1); // Vec3f light_dir(0,0,-1);
 
-				worldCoords[ivert] = Vec3f(x, y, z);
-				// world to screen coords
-				screenCoords[ivert] = Vec3f((int)((x + 1.f) * frameWidth / 2.f + .5f), (int)((y + 1.f) * frameHeight / 2.f + .5f), z);
+		// back face culling
+		if (intensity > 0)
+			triangle(screenCoords, texCoords, intensity, frame, color, texture);
+	}
+}
 
-				auto tx = attrib.texcoords[2 * face.texcoord_index + 0];
-				auto ty = attrib.texcoords[2 * face.texcoord_index + 1];
+template <class Model>
+void drawModel(const Model &mesh, TGAImage &texture, Framebuffer &frame)
+{
+	// pick the pixel formats once, the per-pixel loops are specialized on them
+	frame.image().visit([&](auto color) {
+		if (!texture.visit([&](auto tex) { rasterizeModel(mesh, frame, color, tex); }))
+			rasterizeModel(mesh, frame, color, ImageView<RGB8>()); // no texture, sample black
+	});
+}
 
-				texCoords[ivert] = Vec2f(tx, ty);
-			}
+// lighting uses face normals computed from positions, so vertex normals are never loaded,
+// and without a texture to sample neither are uvs. The texture decodes while the mesh
+// loads, so whether it exists is not known yet: a path is enough to ask for uvs.
+int modelAttributes(const char *texturePath)
+{
+	return texturePath && *texturePath ? Mesh::POSITIONS | Mesh::TEXCOORDS : Mesh::POSITIONS;
+}
 
-			// illumination
-			Vec3f normal = (worldCoords[2] - worldCoords[0]) ^ (worldCoords[1] - worldCoords[0]);
-			normal.normalize();
-			float intensity = normal * Vec3f(0, 0, -1); // Vec3f light_dir(0,0,-1);
+// waits for a requested texture, an unreadable one is an empty image that samples black
+static TGAImage &waitTexture(const TextureCache::Handle &handle, const char *texturePath)
+{
+	static TGAImage none;
+	TGAImage *texture = handle.get();
+	if (!texture)
+	{
+		std::cout << "Unable to read " << texturePath << std::endl;
+		return none;
+	}
+	return *texture;
+}
 
-			// back face culling
-			if (intensity > 0)
-				triangle(screenCoords, texCoords, intensity, zbuffer, frame, texture);
+/*
+ * The OBJ model as frames draw it, loaded once: the texture decodes on the pool while the
+ * OBJ parses, and with --quantize a 16-bit copy replaces the float mesh.
+ */
+struct ObjModel
+{
+	Mesh mesh;
+	QuantizedMesh quantized;
+	TextureCache::Handle textureHandle;
+	TGAImage *texture = NULL;
+};
 
-			faceOffset += numVerts;
-		}
+bool loadObjModel(ObjModel &model, const char *objFilePath, const char *texturePath)
+{
+	model.textureHandle = TextureCache::shared().request(texturePath);
+	if (!loadMesh(model.mesh, objFilePath, modelAttributes(texturePath)))
+		return false;
+	model.texture = &waitTexture(model.textureHandle, texturePath);
+
+	if (quantizeError > 0.f)
+	{
+		// uvs must land within a quarter texel, positions within what was asked for
+		QuantizeBounds bounds;
+		bounds.position = quantizeError;
+		if (model.texture->get_width() > 0)
+			bounds.texcoord = .25f / std::max(model.texture->get_width(), model.texture->get_height());
+		if (model.quantized.quantize(model.mesh, bounds))
+			model.mesh = Mesh(); // only the compact copy stays resident while drawing
 	}
+	return true;
+}
 
-	delete zbuffer;
+void drawObjModel(ObjModel &model, Framebuffer &frame)
+{
+	if (model.quantized.get_nverts())
+		drawModel(model.quantized, *model.texture, frame);
+	else
+		drawModel(model.mesh, *model.texture, frame);
+}
+
+/*
+ * Offline bake: the welded mesh and the decoded texture go into one bundle that render
+ * jobs map and draw from directly, see AssetBundle
+ */
+bool bakeBundle(const char *objFilePath, const char *texturePath, const char *bundlePath)
+{
+	TextureCache::Handle textureHandle = TextureCache::shared().request(texturePath);
+
+	Mesh mesh;
+	if (!loadMesh(mesh, objFilePath, modelAttributes(texturePath)))
+		return false;
+	TGAImage *texture = textureHandle.get();
+	if (!texture)
+		return false;
+
+	AssetBundleWriter writer;
+	return writer.add_mesh(objFilePath, mesh) && writer.add_texture(texturePath, *texture) && writer.write(bundlePath);
+}
+
+/*
+ * Poster rendering: the picture is rendered one band of tiles at a time and each band is
+ * streamed to disk before the next, so memory is width * band rows whatever the height.
+ */
+bool posterRaster(const char *objFilePath, const char *texturePath, const char *outPath, int width, int height)
+{
+	TextureCache::Handle textureHandle = TextureCache::shared().request(texturePath);
+
+	Mesh mesh;
+	if (!loadMesh(mesh, objFilePath, modelAttributes(texturePath)))
+		return false;
+	TGAImage &texture = waitTexture(textureHandle, texturePath);
+
+	TGAStreamWriter out;
+	if (!out.open(outPath, width, height, TGAImage::RGB, TGAImage::BOTTOM_LEFT))
+		return false;
+
+	Framebuffer band(width, Framebuffer::TILE_SIZE, TGAImage::RGB);
+	for (int y0 = 0; y0 < height; y0 += band.get_height())
+	{
+		band.set_band(y0, height);
+		band.clear(Pixel32(0, 0, 0, 255), -std::numeric_limits<float>::max());
+		drawModel(mesh, texture, band);
+		band.resolve();
+
+		int rows = std::min(band.get_height(), height - y0);
+		for (int j = 0; j < rows; j++)
+			if (!out.write_row(band.image().row(j)))
+				return false;
+	}
+	return out.close();
 }
 
 int main(int argc, char **argv)
 {
-	TGAImage frame(500, 500, TGAImage::RGB);
-	triangleRaster("obj/african_head.obj", "obj/", "obj/african_head_diffuse.tga", frame);
+	// cctr [--frames N] [--levels N] [--poster W H] [--stream-obj] [--quantize ERR] [--bake FILE | --bundle FILE]
+	//   --frames N    renders the sequence framebuffer_0000.tga, ...
+	//   --levels N    also writes N half-size previews framebuffer_lod1.tga, ... from the same render
+	//   --poster W H  renders a W x H poster.tga (up to 65535 x 65535) band by band in bounded memory
+	//   --stream-obj  loads an uncached OBJ in one streaming pass instead of in parallel
+	//   --quantize ERR draws from 16-bit quantized vertices if positions stay within ERR model units
+	//   --bake FILE   writes the model and its texture to the asset bundle FILE and exits
+	//   --bundle FILE renders from the asset bundle FILE instead of the OBJ and TGA
+	int frames = 1, levels = 0, posterWidth = 0, posterHeight = 0;
+	const char *bakePath = NULL, *bundlePath = NULL;
+	for (int i = 1; i < argc; i += 2)
+	{
+		if (!strcmp(argv[i], "--stream-obj"))
+		{
+			streamObj = true;
+			i--;
+		}
+		else if (i + 1 >= argc)
+			break;
+		else if (!strcmp(argv[i], "--frames"))
+			frames = std::max(1, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--levels"))
+			levels = std::max(0, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--quantize"))
+			quantizeError = std::max(0.f, (float)atof(argv[i + 1]));
+		else if (!strcmp(argv[i], "--bake"))
+			bakePath = argv[i + 1];
+		else if (!strcmp(argv[i], "--bundle"))
+			bundlePath = argv[i + 1];
+		else if (!strcmp(argv[i], "--poster") && i + 2 < argc)
+		{
+			posterWidth = atoi(argv[i + 1]);
+			posterHeight = atoi(argv[i + 2]);
+			i++;
+		}
+	}
+
+	if (bakePath)
+		return bakeBundle("obj/african_head.obj", "obj/african_head_diffuse.tga", bakePath) ? 0 : 1;
+
+	if (posterWidth > 0 && posterHeight > 0)
+		return posterRaster("obj/african_head.obj", "obj/african_head_diffuse.tga", "poster.tga", posterWidth, posterHeight) ? 0 : 1;
+
+	// declared first so it outlives the frame and every image it recycles for --frames
+	ImagePool pool;
+	Framebuffer frame(500, 500, TGAImage::RGB);
+	frame.clear(Pixel32(0, 0, 0, 255), -std::numeric_limits<float>::max()); // O(tiles), pixels are initialized on first touch
+	frame.image().set_origin(TGAImage::BOTTOM_LEFT); // i want to have the origin at the left bottom corner of the image
+
+	// a bundle is mapped once, its mesh and texture point into the mapping; the OBJ model
+	// is likewise loaded once, every frame only draws
+	AssetBundle bundle;
+	Mesh bundleMesh;
+	TGAImage bundleTexture;
+	ObjModel model;
+	if (bundlePath ? !bundle.open(bundlePath) || !bundle.get_mesh("obj/african_head.obj", bundleMesh) ||
+						 !bundle.get_texture("obj/african_head_diffuse.tga", bundleTexture)
+				   : !loadObjModel(model, "obj/african_head.obj", "obj/african_head_diffuse.tga"))
+		return 1;
+	auto render = [&](Framebuffer &target)
+	{
+		if (bundlePath)
+			drawModel(bundleMesh, bundleTexture, target);
+		else
+			drawObjModel(model, target);
+	};
 
-	frame.flip_vertically(); // i want to have the origin at the left bottom corner of the image
-	frame.write_tga_file("framebuffer.tga");
-	return 0;
+	if (frames == 1)
+	{
+		render(frame);
+		frame.resolve();
+		if (levels == 0)
+			return frame.image().write_tga_file("framebuffer.tga") ? 0 : 1;
+
+		std::vector<std::string> filenames(1, "framebuffer.tga");
+		for (int i = 1; i <= levels; i++)
+			filenames.push_back("framebuffer_lod" + std::to_string(i) + ".tga");
+		return write_tga_pyramid(frame.image(), filenames) ? 0 : 1;
+	}
+
+	// frame N is encoded and written in the background while frame N+1 renders into a recycled buffer
+	FrameWriter writer(1);
+	for (int i = 0; i < frames; i++)
+	{
+		render(frame);
+
+		char filename[64];
+		snprintf(filename, sizeof(filename), "framebuffer_%04d.tga", i);
+		writer.submit(frame.detach(pool), filename);
+	}
+	return writer.flush() ? 0 : 1;
 
 	// TODOS
 	// - gamma correction, see https://github.com/ssloy/tinyrenderer/wiki/Lesson-2:-Triangle-rasterization-and-back-face-culling
@@ -0,0 +1,111 @@
+#include <iostream>
+#include <stdint.h>
+#include "mappedfile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : addr(NULL), length(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {
+}
+#else
+MappedFile::MappedFile() : addr(NULL), length(0) {
+}
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+bool MappedFile::open(const char *filename) {
+	close();
+#ifdef _WIN32
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file==INVALID_HANDLE_VALUE) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || 0==size.QuadPart) {
+		std::cerr << "can't map empty file " << filename << "\n";
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+	if (mapping) addr = (unsigned char *)MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	if (!addr) {
+		std::cerr << "can't map file " << filename << "\n";
+		close();
+		return false;
+	}
+	length = (size_t)size.QuadPart;
+#else
+	int fd = ::open(filename, O_RDONLY);
+	if (fd<0) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st)<0 || 0==st.st_size) {
+		std::cerr << "can't map empty file " << filename << "\n";
+		::close(fd);
+		return false;
+	}
+	void *p = mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping keeps its own reference
+	if (MAP_FAILED==p) {
+		std::cerr << "can't map file " << filename << "\n";
+		return false;
+	}
+	addr = (unsigned char *)p;
+	length = (size_t)st.st_size;
+#endif
+	return true;
+}
+
+void MappedFile::prefetch() {
+	if (!addr) return;
+#ifdef _WIN32
+#if _WIN32_WINNT>=0x0602
+	WIN32_MEMORY_RANGE_ENTRY range = {addr, length};
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#endif
+#else
+	madvise(addr, length, MADV_WILLNEED);
+#endif
+}
+
+void MappedFile::release(const void *begin, size_t len) {
+	const unsigned char *b = (const unsigned char *)begin;
+	if (!addr || b<addr || len>length || b-addr>(ptrdiff_t)(length-len)) return;
+#ifdef _WIN32
+	// unlocking pages that were never locked drops them from the working set
+	VirtualUnlock((void *)b, len);
+#else
+	uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t lo = ((uintptr_t)b+page-1) & ~(page-1), hi = ((uintptr_t)b+len) & ~(page-1);
+	if (hi>lo) madvise((void *)lo, hi-lo, MADV_DONTNEED); // never written, so nothing is lost
+#endif
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+	if (addr) UnmapViewOfFile(addr);
+	if (mapping) CloseHandle(mapping);
+	if (file!=INVALID_HANDLE_VALUE) CloseHandle(file);
+	mapping = NULL;
+	file = INVALID_HANDLE_VALUE;
+#else
+	if (addr) munmap(addr, length);
+#endif
+	addr = NULL;
+	length = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include <stddef.h>
+
+// Whole-file, copy-on-write memory mapping. Pages are read lazily by the OS;
+// writes through data() stay private to the process and never reach the file.
+class MappedFile {
+	unsigned char *addr;
+	size_t length;
+#ifdef _WIN32
+	void *file;
+	void *mapping;
+#endif
+public:
+	MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator =(const MappedFile &) = delete;
+	~MappedFile();
+	bool open(const char *filename);
+	void close();
+	void prefetch(); // asks the OS to start reading the whole file in, without waiting
+	// Takes the whole pages inside [begin, begin+len) out of the process' resident set,
+	// e.g. once a parse is past them. They stay valid and are read again on next touch.
+	void release(const void *begin, size_t len);
+	unsigned char *data() const { return addr; }
+	size_t size() const { return length; }
+	bool is_open() const { return addr!=NULL; }
+};
+
+#endif //__MAPPEDFILE_H__
@@ -0,0 +1,397 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <string.h>
+#include "mesh.h"
+#include "mappedfile.h"
+
+namespace {
+
+const char CACHE_MAGIC[4] = {'C', 'C', 'M', 'C'};
+const uint32_t CACHE_VERSION = 1;
+const size_t ALIGNMENT = 64;
+
+// native byte order, the cache is a local artifact and not meant to travel
+struct MeshCacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+	uint64_t nverts;
+	uint64_t nindices;
+	uint32_t attributes;
+	uint32_t requested; // attributes the build was asked for, some may be absent from the source
+	uint64_t nbytes;
+};
+static_assert(sizeof(MeshCacheHeader)%ALIGNMENT==0, "the header keeps the block aligned in the mapping");
+
+size_t align_up(size_t n) {
+	return (n+ALIGNMENT-1) & ~(ALIGNMENT-1);
+}
+
+// Identifies the source without reading all of it: size, mtime and an FNV-1a
+// hash of the first and last 64 KB, which catches copies that keep the mtime.
+bool stamp_source(const char *source, MeshCacheHeader &header) {
+	std::error_code ec;
+	std::filesystem::path path(source);
+	uintmax_t size = std::filesystem::file_size(path, ec);
+	if (ec) return false;
+	std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, ec);
+	if (ec) return false;
+	std::ifstream in(source, std::ios::binary);
+	if (!in.is_open()) return false;
+
+	const size_t SAMPLE = 65536;
+	std::vector<char> buf(SAMPLE);
+	uint64_t hash = 0xCBF29CE484222325ull;
+	for (int part=0; part<2; part++) {
+		uint64_t offset = part ? (size>SAMPLE ? size-SAMPLE : 0) : 0;
+		size_t len = (size_t)std::min<uintmax_t>(SAMPLE, size);
+		in.seekg((std::streamoff)offset);
+		in.read(buf.data(), (std::streamsize)len);
+		if (!in.good()) return false;
+		for (size_t i=0; i<len; i++) {
+			hash = (hash ^ (unsigned char)buf[i])*0x100000001B3ull;
+		}
+	}
+	header.source_size  = size;
+	header.source_mtime = (int64_t)mtime.time_since_epoch().count();
+	header.source_hash  = hash;
+	return true;
+}
+
+}
+
+Mesh::Mesh() : data(NULL), nbytes(0), nverts(0), nindices(0), attributes(0),
+	positions(NULL), texcoords(NULL), normals(NULL), indices(NULL), mapping(NULL), owned(true) {
+}
+
+Mesh::Mesh(Mesh &&mesh) noexcept : data(mesh.data), nbytes(mesh.nbytes), nverts(mesh.nverts), nindices(mesh.nindices),
+	attributes(mesh.attributes), positions(mesh.positions), texcoords(mesh.texcoords), normals(mesh.normals),
+	indices(mesh.indices), mapping(mesh.mapping), owned(mesh.owned) {
+	mesh.data = NULL;
+	mesh.mapping = NULL;
+	mesh.release_data();
+}
+
+Mesh & Mesh::operator =(Mesh &&mesh) noexcept {
+	if (this != &mesh) {
+		release_data();
+		data       = mesh.data;
+		nbytes     = mesh.nbytes;
+		nverts     = mesh.nverts;
+		nindices   = mesh.nindices;
+		attributes = mesh.attributes;
+		positions  = mesh.positions;
+		texcoords  = mesh.texcoords;
+		normals    = mesh.normals;
+		indices    = mesh.indices;
+		mapping    = mesh.mapping;
+		owned      = mesh.owned;
+		mesh.data = NULL;
+		mesh.mapping = NULL;
+		mesh.release_data();
+	}
+	return *this;
+}
+
+Mesh::~Mesh() {
+	release_data();
+}
+
+void Mesh::release_data() {
+	if (mapping) {
+		delete mapping;
+	} else if (owned) {
+		delete [] data;
+	}
+	mapping = NULL;
+	owned = true;
+	data = NULL;
+	nbytes = nverts = nindices = 0;
+	attributes = 0;
+	positions = texcoords = normals = NULL;
+	indices = NULL;
+}
+
+size_t Mesh::layout_size(size_t nverts, size_t nindices, int attributes) {
+	size_t n = align_up(nverts*3*sizeof(float));
+	if (attributes & TEXCOORDS) n += align_up(nverts*2*sizeof(float));
+	if (attributes & NORMALS)   n += align_up(nverts*3*sizeof(float));
+	return n+align_up(nindices*sizeof(uint32_t));
+}
+
+// carves the arrays out of the block in a fixed order: positions, texcoords, normals, indices
+void Mesh::set_arrays(unsigned char *base) {
+	data = base;
+	positions = (float *)base;
+	base += align_up(nverts*3*sizeof(float));
+	texcoords = NULL;
+	if (attributes & TEXCOORDS) {
+		texcoords = (float *)base;
+		base += align_up(nverts*2*sizeof(float));
+	}
+	normals = NULL;
+	if (attributes & NORMALS) {
+		normals = (float *)base;
+		base += align_up(nverts*3*sizeof(float));
+	}
+	indices = (uint32_t *)base;
+}
+
+bool Mesh::allocate(size_t nv, size_t ni, int attrs) {
+	release_data();
+	if (nv>UINT32_MAX || ni%3) {
+		std::cerr << "bad mesh size " << nv << " vertices, " << ni << " indices\n";
+		return false;
+	}
+	nverts = nv;
+	nindices = ni;
+	attributes = attrs | POSITIONS;
+	nbytes = layout_size(nverts, nindices, attributes);
+	// operator new aligns to 16 which is all the arrays need in memory, 64 is for the file
+	set_arrays(new unsigned char[nbytes]);
+	return true;
+}
+
+bool Mesh::attach(unsigned char *block, size_t size, size_t nv, size_t ni, int attrs) {
+	release_data();
+	if (nv>UINT32_MAX || ni%3 || !(attrs & POSITIONS) || size!=layout_size(nv, ni, attrs)) {
+		std::cerr << "bad mesh block\n";
+		return false;
+	}
+	nverts     = nv;
+	nindices   = ni;
+	attributes = attrs;
+	nbytes     = size;
+	owned      = false;
+	set_arrays(block);
+	for (size_t i=0; i<nindices; i++) {
+		if (indices[i]>=nverts) {
+			release_data();
+			std::cerr << "bad mesh block\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Mesh::build(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes) {
+	size_t ncorners = 0, ntriangles = 0;
+	for (size_t s=0; s<shapes.size(); s++) {
+		size_t n = shapes[s].mesh.indices.size(), nfaces = shapes[s].mesh.num_face_vertices.size();
+		ncorners += n;
+		ntriangles += n>2*nfaces ? n-2*nfaces : 0;
+	}
+	MeshBuilder builder;
+	builder.borrow(attrib.vertices, attrib.texcoords, attrib.normals);
+	builder.reserve(attrib.vertices.size()/3, attrib.texcoords.size()/2, attrib.normals.size()/3, ncorners, ntriangles);
+	std::vector<int> v, t, n;
+	for (size_t s=0; s<shapes.size(); s++) {
+		const tinyobj::mesh_t &mesh = shapes[s].mesh;
+		size_t offset = 0;
+		for (size_t f=0; f<mesh.num_face_vertices.size(); f++) {
+			int ncorners = mesh.num_face_vertices[f];
+			v.resize(ncorners);
+			t.resize(ncorners);
+			n.resize(ncorners);
+			for (int i=0; i<ncorners; i++) {
+				const tinyobj::index_t &idx = mesh.indices[offset+i];
+				v[i] = idx.vertex_index;
+				t[i] = idx.texcoord_index;
+				n[i] = idx.normal_index;
+			}
+			if (!builder.add_face(v.data(), t.data(), n.data(), ncorners)) return false;
+			offset += ncorners;
+		}
+	}
+	return builder.finish(*this);
+}
+
+bool Mesh::write_cache_file(const char *filename, const char *source, int requested) const {
+	MeshCacheHeader header;
+	memset((void *)&header, 0, sizeof(header));
+	if (!stamp_source(source, header)) {
+		std::cerr << "can't stat " << source << "\n";
+		return false;
+	}
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version    = CACHE_VERSION;
+	header.nverts     = nverts;
+	header.nindices   = nindices;
+	header.attributes = attributes;
+	header.requested  = (uint32_t)(attributes | requested);
+	header.nbytes     = nbytes;
+
+	// written aside and renamed into place, so a reader never maps a half-written cache
+	std::string tmp = std::string(filename)+".tmp";
+	std::ofstream out(tmp.c_str(), std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << tmp << "\n";
+		return false;
+	}
+	out.write((char *)&header, sizeof(header));
+	out.write((char *)data, (std::streamsize)nbytes);
+	out.close();
+	std::error_code ec;
+	if (!out.good() || (std::filesystem::rename(tmp, filename, ec), ec)) {
+		std::cerr << "can't write the mesh cache " << filename << "\n";
+		std::filesystem::remove(tmp, ec);
+		return false;
+	}
+	return true;
+}
+
+bool Mesh::map_cache_file(const char *filename, const char *source, int required) {
+	std::error_code ec;
+	if (!std::filesystem::exists(filename, ec)) return false;
+	MeshCacheHeader current;
+	if (!stamp_source(source, current)) return false;
+
+	MappedFile *map = new MappedFile();
+	if (!map->open(filename)) {
+		delete map;
+		return false;
+	}
+	MeshCacheHeader header;
+	if (map->size()<sizeof(header)) {
+		delete map;
+		std::cerr << "truncated mesh cache " << filename << "\n";
+		return false;
+	}
+	memcpy(&header, map->data(), sizeof(header));
+	if (memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) || header.version!=CACHE_VERSION
+		|| header.source_size!=current.source_size || header.source_mtime!=current.source_mtime
+		|| header.source_hash!=current.source_hash || (required & ~(header.attributes | header.requested))) {
+		delete map; // stale, from another version or too lean, the caller rebuilds it
+		return false;
+	}
+	if (header.nverts>UINT32_MAX || header.nbytes>map->size()-sizeof(header)
+		|| !attach(map->data()+sizeof(header), (size_t)header.nbytes, (size_t)header.nverts, (size_t)header.nindices, header.attributes)) {
+		delete map;
+		std::cerr << "corrupt mesh cache " << filename << "\n";
+		return false;
+	}
+	mapping = map;
+	return true;
+}
+
+void MeshBuilder::rehash(size_t nslots) {
+	size_t n = 64;
+	while (n<nslots) n *= 2;
+	slots.assign(n, 0);
+	for (size_t i=0; i<vertices.size(); i++) {
+		size_t h = CornerHash()(vertices[i]) & (n-1);
+		while (slots[h]) h = (h+1) & (n-1);
+		slots[h] = (uint32_t)i+1;
+	}
+}
+
+uint32_t MeshBuilder::weld(const Corner &c) {
+	if ((vertices.size()+1)*2>slots.size()) rehash(slots.size()*2); // at most half full
+	size_t mask = slots.size()-1;
+	for (size_t h = CornerHash()(c) & mask; ; h = (h+1) & mask) {
+		if (!slots[h]) {
+			vertices.push_back(c);
+			slots[h] = (uint32_t)vertices.size();
+			return slots[h]-1;
+		}
+		if (vertices[slots[h]-1]==c) return slots[h]-1;
+	}
+}
+
+MeshBuilder::MeshBuilder() : source_positions(&positions), source_texcoords(&texcoords), source_normals(&normals) {
+}
+
+void MeshBuilder::borrow(const std::vector<float> &p, const std::vector<float> &t, const std::vector<float> &n) {
+	source_positions = &p;
+	source_texcoords = &t;
+	source_normals   = &n;
+}
+
+void MeshBuilder::reserve(size_t npositions, size_t ntexcoords, size_t nnormals, size_t ncorners, size_t ntriangles) {
+	if (source_positions==&positions) {
+		positions.reserve(3*npositions);
+		texcoords.reserve(2*ntexcoords);
+		normals.reserve(3*nnormals);
+	}
+	triangles.reserve(3*ntriangles);
+	size_t nverts = std::min(ncorners, std::max(npositions, std::max(ntexcoords, nnormals)));
+	vertices.reserve(nverts);
+	if (slots.size()<2*nverts) rehash(2*nverts);
+}
+
+bool MeshBuilder::add_face(const int *v, const int *t, const int *n, int ncorners) {
+	int npos = (int)(source_positions->size()/3), ntex = (int)(source_texcoords->size()/2), nnrm = (int)(source_normals->size()/3);
+	for (int i=0; i<ncorners; i++) {
+		if (v[i]<0 || v[i]>=npos || t[i]>=ntex || n[i]>=nnrm) {
+			std::cerr << "face index out of range\n";
+			return false;
+		}
+	}
+	if (ncorners<3) return true; // no area, dropped like tinyobj drops it
+	if (vertices.size()+ncorners>UINT32_MAX) {
+		std::cerr << "too many vertices\n";
+		return false;
+	}
+	uint32_t first = 0, prev = 0;
+	for (int i=0; i<ncorners; i++) {
+		Corner c = {v[i], t[i]<0 ? -1 : t[i], n[i]<0 ? -1 : n[i]};
+		uint32_t id = weld(c);
+		if (i==0) first = id;
+		if (i>=2) {
+			triangles.push_back(first);
+			triangles.push_back(prev);
+			triangles.push_back(id);
+		}
+		prev = id;
+	}
+	return true;
+}
+
+bool MeshBuilder::finish(Mesh &mesh) {
+	int attrs = Mesh::POSITIONS;
+	if (!source_texcoords->empty()) attrs |= Mesh::TEXCOORDS;
+	if (!source_normals->empty())   attrs |= Mesh::NORMALS;
+	const float *vp = source_positions->data(), *vt = source_texcoords->data(), *vn = source_normals->data();
+	// the weld table is done with, drop it before the mesh block is allocated
+	std::vector<uint32_t>().swap(slots);
+	if (!mesh.allocate(vertices.size(), triangles.size(), attrs)) return false;
+	float *p = mesh.get_positions(), *uv = mesh.get_texcoords(), *nrm = mesh.get_normals();
+	for (size_t i=0; i<vertices.size(); i++) {
+		const Corner &c = vertices[i];
+		memcpy(p+3*i, vp+3*(size_t)c.v, 3*sizeof(float));
+		if (uv) {
+			if (c.t<0) {
+				uv[2*i] = uv[2*i+1] = 0.f;
+			} else {
+				memcpy(uv+2*i, vt+2*(size_t)c.t, 2*sizeof(float));
+			}
+		}
+		if (nrm) {
+			if (c.n<0) {
+				nrm[3*i] = nrm[3*i+1] = nrm[3*i+2] = 0.f;
+			} else {
+				memcpy(nrm+3*i, vn+3*(size_t)c.n, 3*sizeof(float));
+			}
+		}
+	}
+	if (!triangles.empty()) {
+		memcpy(mesh.get_indices(), triangles.data(), triangles.size()*sizeof(uint32_t));
+	}
+	clear();
+	return true;
+}
+
+// releases the memory too, a builder is usually done once its mesh is finished
+void MeshBuilder::clear() {
+	std::vector<uint32_t>().swap(slots);
+	std::vector<Corner>().swap(vertices);
+	std::vector<uint32_t>().swap(triangles);
+	std::vector<float>().swap(positions);
+	std::vector<float>().swap(texcoords);
+	std::vector<float>().swap(normals);
+	borrow(positions, texcoords, normals);
+}
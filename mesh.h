@@ -0,0 +1,125 @@
+#ifndef __MESH_H__
+#define __MESH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <tinyobjloader/tiny_obj_loader.h>
+
+class MappedFile;
+
+// Renderer mesh: welded vertices in structure-of-arrays layout plus a triangle
+// index list. All arrays live in one block, either owned or pointing straight
+// into a mapped cache file, so a cached mesh renders without parsing or copying.
+class Mesh {
+public:
+	enum Attribute {
+		POSITIONS=1, TEXCOORDS=2, NORMALS=4, ALL_ATTRIBUTES=7
+	};
+protected:
+	unsigned char *data;
+	size_t nbytes;
+	size_t nverts;
+	size_t nindices;
+	int attributes;
+	float *positions; // xyz per vertex
+	float *texcoords; // uv per vertex, NULL without TEXCOORDS
+	float *normals;   // xyz per vertex, NULL without NORMALS
+	uint32_t *indices; // three per triangle
+	MappedFile *mapping; // the cache file data points into, if any
+	bool owned; // false when data is borrowed, see attach()
+
+	void release_data();
+	void set_arrays(unsigned char *base);
+public:
+	Mesh();
+	Mesh(const Mesh &) = delete;
+	Mesh(Mesh &&mesh) noexcept;
+	Mesh & operator =(const Mesh &) = delete;
+	Mesh & operator =(Mesh &&mesh) noexcept;
+	~Mesh();
+
+	// size of the single block holding all arrays, each one 64-byte aligned
+	static size_t layout_size(size_t nverts, size_t nindices, int attributes);
+	bool allocate(size_t nverts, size_t nindices, int attributes);
+	// Points the mesh at a block laid out as by layout_size(), e.g. inside an asset
+	// bundle, without copying. The memory is borrowed and must outlive the mesh.
+	bool attach(unsigned char *block, size_t nbytes, size_t nverts, size_t nindices, int attributes);
+	bool build(const tinyobj::attrib_t &attrib, const std::vector<tinyobj::shape_t> &shapes);
+
+	// The cache holds the block as is, behind a header recording the source's size,
+	// mtime and a hash of its head and tail, and which attributes the build was asked
+	// for: an OBJ without 'vt' lines still satisfies a later TEXCOORDS request.
+	// map_cache_file() fails quietly when the cache is missing, was built from a
+	// different source or was built for fewer attributes than asked for.
+	bool write_cache_file(const char *filename, const char *source, int requested=0) const;
+	bool map_cache_file(const char *filename, const char *source, int attributes=POSITIONS);
+
+	size_t get_nverts() const { return nverts; }
+	size_t get_nindices() const { return nindices; }
+	size_t get_ntriangles() const { return nindices/3; }
+	int get_attributes() const { return attributes; }
+	bool has(Attribute a) const { return (attributes & a)!=0; }
+	bool is_mapped() const { return mapping!=NULL; }
+	const unsigned char *buffer() const { return data; } // the whole block, buffer_size() bytes
+	size_t buffer_size() const { return nbytes; }
+	float *get_positions() { return positions; }
+	float *get_texcoords() { return texcoords; }
+	float *get_normals() { return normals; }
+	uint32_t *get_indices() { return indices; }
+	const float *get_positions() const { return positions; }
+	const float *get_texcoords() const { return texcoords; }
+	const float *get_normals() const { return normals; }
+	const uint32_t *get_indices() const { return indices; }
+};
+
+// Welds OBJ-style faces, whose corners index positions, texcoords and normals
+// separately, into shared vertices. Polygons are fanned into triangles.
+class MeshBuilder {
+	struct Corner {
+		int v, t, n;
+		bool operator ==(const Corner &c) const { return v==c.v && t==c.t && n==c.n; }
+	};
+	struct CornerHash {
+		size_t operator ()(const Corner &c) const {
+			uint64_t h = (uint64_t)(uint32_t)c.v*0x9E3779B97F4A7C15ull;
+			h ^= ((uint64_t)(uint32_t)c.t<<32 | (uint32_t)c.n)*0xC2B2AE3D27D4EB4Full;
+			return (size_t)(h ^ h>>29);
+		}
+	};
+
+	std::vector<uint32_t> slots;  // open addressing weld table, vertex id+1 or 0 when free
+	std::vector<Corner> vertices; // the corner each welded vertex was made from
+	std::vector<uint32_t> triangles;
+	// what faces index: the public arrays below, or the caller's after borrow()
+	const std::vector<float> *source_positions;
+	const std::vector<float> *source_texcoords;
+	const std::vector<float> *source_normals;
+
+	void rehash(size_t nslots);
+	uint32_t weld(const Corner &c);
+public:
+	// raw OBJ attribute arrays, 'v' xyz, 'vt' uv, 'vn' xyz
+	std::vector<float> positions;
+	std::vector<float> texcoords;
+	std::vector<float> normals;
+
+	MeshBuilder();
+	MeshBuilder(const MeshBuilder &) = delete;
+	MeshBuilder & operator =(const MeshBuilder &) = delete;
+	// Welds against the caller's arrays instead of the public ones, without copying
+	// them; they must stay alive and unchanged until finish().
+	void borrow(const std::vector<float> &positions, const std::vector<float> &texcoords, const std::vector<float> &normals);
+	// Sizes every array up front from element counts (ncorners and ntriangles over all
+	// faces), so building allocates a constant number of times. The weld table is sized
+	// for as many vertices as the largest attribute array, seams may grow it once.
+	// Borrowed arrays are not reserved.
+	void reserve(size_t npositions, size_t ntexcoords, size_t nnormals, size_t ncorners, size_t ntriangles);
+	// zero-based indices, -1 for an absent texcoord or normal; false on a bad index.
+	// Faces of fewer than three corners are skipped.
+	bool add_face(const int *v, const int *t, const int *n, int ncorners);
+	bool finish(Mesh &mesh);
+	void clear();
+};
+
+#endif //__MESH_H__
@@ -0,0 +1,435 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include "meshcodec.h"
+#include "mesh.h"
+#include "mappedfile.h"
+#include "pixel.h" // TGA_SSE2
+
+namespace {
+
+const char PACKED_MAGIC[4] = {'C', 'C', 'M', 'Z'};
+const uint32_t PACKED_VERSION = 2;
+const int NCOMPONENTS = 8; // px py pz u v nx ny nz
+const int GROUP = 16;      // values sharing one bit width
+const int PADDING = 8;     // zero bytes closing each packed stream
+const int BLOCK = 256;     // values unpacked ahead of the vector pass, so it reads settled stores
+const int CACHE_SIZE = 16; // post-transform cache Tipsify optimizes for
+
+struct PackedHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t nverts;
+	uint32_t nindices;
+	uint32_t attributes;
+	uint8_t bits[NCOMPONENTS]; // 0 for an absent component
+	float base[NCOMPONENTS];   // value = base + quantized*step
+	float step[NCOMPONENTS];
+};
+
+/*
+ * Group bit packing: every 16 values get a byte with the bit width of the
+ * largest, then the 16 values at that width, 2*width bytes, so groups stay
+ * byte aligned. Small deltas cost few bits and a run of zeros one byte a
+ * group; decoding is a load, shift and mask per value with no branches.
+ */
+
+void put_u32(std::vector<unsigned char> &out, uint32_t v) {
+	unsigned char b[4];
+	memcpy(b, &v, 4);
+	out.insert(out.end(), b, b+4);
+}
+
+void put_packed(std::vector<unsigned char> &out, const std::vector<uint32_t> &values) {
+	size_t n = values.size();
+	put_u32(out, (uint32_t)n);
+	size_t start = out.size();
+	put_u32(out, 0); // byte count, known at the end
+	for (size_t i=0; i<n; i+=GROUP) {
+		uint32_t group[GROUP] = {0}, any = 0;
+		for (size_t k=0; k<(size_t)GROUP && i+k<n; k++) any |= group[k] = values[i+k];
+		int width = 0;
+		while (width<32 && any>>width) width++;
+		out.push_back((unsigned char)width);
+		uint64_t acc = 0;
+		int nbits = 0;
+		for (int k=0; k<GROUP; k++) {
+			acc |= (uint64_t)group[k]<<nbits;
+			for (nbits+=width; nbits>=8; nbits-=8) {
+				out.push_back((unsigned char)acc);
+				acc >>= 8;
+			}
+		}
+	}
+	out.insert(out.end(), PADDING, 0);
+	uint32_t nbytes = (uint32_t)(out.size()-start-4);
+	memcpy(&out[start], &nbytes, 4);
+}
+
+struct Reader {
+	const unsigned char *p;
+	const unsigned char *end;
+	bool get_u32(uint32_t &v) {
+		if (end-p<4) return false;
+		memcpy(&v, p, 4);
+		p += 4;
+		return true;
+	}
+};
+
+// the byte span of the next packed stream, which must hold n values
+bool get_packed(Reader &in, size_t n, const unsigned char *&begin, const unsigned char *&end) {
+	uint32_t count, nbytes;
+	if (!in.get_u32(count) || count!=n || !in.get_u32(nbytes) || (size_t)(in.end-in.p)<nbytes) return false;
+	begin = in.p;
+	end = in.p = in.p+nbytes;
+	return true;
+}
+
+// value K of a group of width W; the load is a whole 8 byte word, which the
+// padding after the last group keeps inside the stream
+template <int W, size_t K>
+inline uint32_t unpack_value(const unsigned char *p) {
+	uint64_t word;
+	memcpy(&word, p+(K*W>>3), 8);
+	return (uint32_t)(word>>(K*W&7) & (((uint64_t)1<<W)-1));
+}
+
+// one group of width W into v[0], v[STRIDE], ..., unrolled
+template <int W, int STRIDE, size_t... K>
+const unsigned char *unpack_width(const unsigned char *p, uint32_t *v, std::index_sequence<K...>) {
+	((v[K*STRIDE] = unpack_value<W, K>(p)), ...);
+	return p+2*W;
+}
+
+template <int W, int STRIDE>
+const unsigned char *unpack_width(const unsigned char *p, uint32_t *v) {
+	return unpack_width<W, STRIDE>(p, v, std::make_index_sequence<GROUP>());
+}
+
+typedef const unsigned char *(*UnpackFn)(const unsigned char *, uint32_t *);
+
+template <int STRIDE, size_t... W>
+std::array<UnpackFn, 33> unpack_table(std::index_sequence<W...>) {
+	return {{unpack_width<(int)W, STRIDE>...}};
+}
+
+// widths 0..32, with constant shifts each; indices unpack one after another,
+// attribute components into the lanes of a 4 wide row per vertex
+const std::array<UnpackFn, 33> UNPACK_SINGLE = unpack_table<1>(std::make_index_sequence<33>());
+const std::array<UnpackFn, 33> UNPACK_LANES  = unpack_table<4>(std::make_index_sequence<33>());
+
+// NULL if the group runs past the stream
+inline const unsigned char *unpack_group(const unsigned char *p, const unsigned char *end, const std::array<UnpackFn, 33> &table, uint32_t *v) {
+	if (end-p<1+PADDING) return NULL;
+	int width = *p++;
+	if (width>32 || end-p<2*width+PADDING) return NULL;
+	return table[width](p, v);
+}
+
+inline uint32_t unzigzag(uint32_t z) {
+	return (z>>1) ^ (0u-(z&1));
+}
+
+// indices for m codes: 0 is the next new vertex, anything else counts back
+// from it; bad gets set for a code reaching before the first vertex
+void decode_indices(const uint32_t *v, size_t m, uint32_t &next, uint32_t &bad, uint32_t *out) {
+	size_t k = 0;
+#ifdef TGA_SSE2
+	// a running count of the zero codes gives each one its next without a serial chain
+	__m128i base = _mm_set1_epi32((int)next), flip = _mm_set1_epi32(INT32_MIN), over = _mm_setzero_si128();
+	for (; k+4<=m; k+=4) {
+		__m128i code = _mm_loadu_si128((const __m128i *)(v+k));
+		__m128i fresh = _mm_cmpeq_epi32(code, _mm_setzero_si128()); // -1 for a new vertex
+		__m128i count = _mm_sub_epi32(_mm_setzero_si128(), fresh);
+		count = _mm_add_epi32(count, _mm_slli_si128(count, 4));
+		count = _mm_add_epi32(count, _mm_slli_si128(count, 8));
+		__m128i before = _mm_add_epi32(base, _mm_add_epi32(count, fresh));
+		_mm_storeu_si128((__m128i *)(out+k), _mm_sub_epi32(before, code));
+		over = _mm_or_si128(over, _mm_cmpgt_epi32(_mm_xor_si128(code, flip), _mm_xor_si128(before, flip)));
+		base = _mm_add_epi32(base, _mm_shuffle_epi32(count, 0xFF));
+	}
+	next = (uint32_t)_mm_cvtsi128_si32(base);
+	bad |= _mm_movemask_epi8(over);
+#endif
+	for (; k<m; k++) {
+		bad |= v[k]>next;
+		out[k] = next-v[k];
+		next += v[k]==0;
+	}
+}
+
+// unzigzag, running sum and dequantize for m vertices of n components, with q
+// holding each vertex's deltas in 4 lanes; out has room for m*n floats
+void dequantize(const uint32_t *q, size_t m, int n, uint32_t prev[4], const uint32_t mask[4],
+	const float base[4], const float step[4], float *out) {
+	size_t k = 0;
+#ifdef TGA_SSE2
+	__m128i sum = _mm_loadu_si128((const __m128i *)prev), bits = _mm_loadu_si128((const __m128i *)mask);
+	__m128i one = _mm_set1_epi32(1);
+	__m128 b = _mm_loadu_ps(base), s = _mm_loadu_ps(step);
+	// a 3 component store writes a float past the vertex, so the last one goes scalar
+	for (size_t wide=n==3 ? m-1 : m; k<wide; k++) {
+		__m128i z = _mm_load_si128((const __m128i *)(q+4*k));
+		__m128i d = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(z, one)));
+		sum = _mm_and_si128(_mm_add_epi32(sum, d), bits);
+		__m128 f = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), s), b);
+		if (n==3) {
+			_mm_storeu_ps(out+3*k, f);
+		} else {
+			_mm_storel_pi((__m64 *)(out+2*k), f);
+		}
+	}
+	_mm_storeu_si128((__m128i *)prev, sum);
+#endif
+	for (; k<m; k++) {
+		for (int c=0; c<n; c++) {
+			prev[c] = (prev[c]+unzigzag(q[4*k+c])) & mask[c];
+			out[k*n+c] = base[c]+prev[c]*step[c];
+		}
+	}
+}
+
+/*
+ * Tipsify (Sander, Nehab, Barczak 2007): greedy fanning around recently used
+ * vertices, linear time, returns triangles in cache friendly order
+ */
+std::vector<uint32_t> tipsify(const uint32_t *indices, size_t ntris, size_t nverts) {
+	std::vector<uint32_t> offset(nverts+1, 0), adjacency(ntris*3), live(nverts, 0);
+	for (size_t i=0; i<ntris*3; i++) live[indices[i]]++;
+	for (size_t v=0; v<nverts; v++) offset[v+1] = offset[v]+live[v];
+	std::vector<uint32_t> fill(offset.begin(), offset.end()-1);
+	for (size_t i=0; i<ntris*3; i++) adjacency[fill[indices[i]]++] = (uint32_t)(i/3);
+
+	std::vector<uint32_t> stamp(nverts, 0), dead_end, order;
+	std::vector<char> emitted(ntris, 0);
+	order.reserve(ntris);
+	uint32_t time = CACHE_SIZE+1;
+	size_t cursor = 0;
+	long f = nverts ? 0 : -1;
+	std::vector<uint32_t> candidates;
+	while (f>=0) {
+		candidates.clear();
+		for (uint32_t k=offset[f]; k<offset[f+1]; k++) {
+			uint32_t t = adjacency[k];
+			if (emitted[t]) continue;
+			emitted[t] = 1;
+			order.push_back(t);
+			for (int c=0; c<3; c++) {
+				uint32_t v = indices[3*t+c];
+				dead_end.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time-stamp[v]>(uint32_t)CACHE_SIZE) stamp[v] = time++;
+			}
+		}
+		// next fan: the candidate still in cache that stays there longest
+		long best = -1;
+		int best_priority = -1;
+		for (size_t i=0; i<candidates.size(); i++) {
+			uint32_t v = candidates[i];
+			if (!live[v]) continue;
+			int priority = 0;
+			if (time-stamp[v]+2*live[v]<=(uint32_t)CACHE_SIZE) priority = (int)(time-stamp[v]);
+			if (priority>best_priority) {
+				best_priority = priority;
+				best = v;
+			}
+		}
+		if (best<0) {
+			while (!dead_end.empty() && best<0) {
+				uint32_t v = dead_end.back();
+				dead_end.pop_back();
+				if (live[v]) best = v;
+			}
+			while (best<0 && cursor<nverts) {
+				if (live[cursor]) best = (long)cursor;
+				cursor++;
+			}
+		}
+		f = best;
+	}
+	return order;
+}
+
+// deltas wrap around modulo 2^bits so they always fit in the quantized width
+inline uint16_t zigzag(uint32_t delta, int bits) {
+	int32_t d = (int32_t)(delta<<(32-bits))>>(32-bits);
+	return (uint16_t)(((uint32_t)d<<1) ^ (uint32_t)(d>>31));
+}
+
+
+}
+
+bool encode_mesh(const Mesh &mesh, std::vector<unsigned char> &out, const MeshCodecOptions &options) {
+	size_t nverts = mesh.get_nverts(), ntris = mesh.get_ntriangles();
+	int bits[3] = {options.position_bits, options.texcoord_bits, options.normal_bits};
+	for (int i=0; i<3; i++) {
+		if (bits[i]<1 || bits[i]>16) {
+			std::cerr << "quantization bits must be 1..16\n";
+			return false;
+		}
+	}
+	const uint32_t *indices = mesh.get_indices();
+
+	// triangles in cache order, vertices renumbered by first use
+	std::vector<uint32_t> order = tipsify(indices, ntris, nverts);
+	std::vector<uint32_t> remap(nverts, UINT32_MAX), vertex_order;
+	vertex_order.reserve(nverts);
+	std::vector<uint32_t> codes;
+	codes.reserve(ntris*3);
+	uint32_t next = 0;
+	for (size_t i=0; i<order.size(); i++) {
+		for (int c=0; c<3; c++) {
+			uint32_t v = indices[3*order[i]+c];
+			if (remap[v]==UINT32_MAX) {
+				remap[v] = next++;
+				vertex_order.push_back(v);
+				codes.push_back(0);
+			} else {
+				codes.push_back(next-remap[v]); // how far back, recent vertices are small
+			}
+		}
+	}
+	for (size_t v=0; v<nverts; v++) {
+		if (remap[v]==UINT32_MAX) vertex_order.push_back((uint32_t)v); // unreferenced, kept for the count
+	}
+
+	PackedHeader header;
+	memset((void *)&header, 0, sizeof(header));
+	memcpy(header.magic, PACKED_MAGIC, sizeof(header.magic));
+	header.version    = PACKED_VERSION;
+	header.nverts     = (uint32_t)nverts;
+	header.nindices   = (uint32_t)mesh.get_nindices();
+	header.attributes = (uint32_t)mesh.get_attributes();
+	const float *arrays[NCOMPONENTS];
+	int strides[NCOMPONENTS];
+	for (int c=0; c<NCOMPONENTS; c++) {
+		const float *a = c<3 ? mesh.get_positions() : (c<5 ? mesh.get_texcoords() : mesh.get_normals());
+		arrays[c] = a ? a+(c<3 ? c : (c<5 ? c-3 : c-5)) : NULL;
+		strides[c] = c>=3 && c<5 ? 2 : 3;
+		header.bits[c] = a ? (uint8_t)bits[c<3 ? 0 : (c<5 ? 1 : 2)] : 0;
+	}
+
+	out.assign((unsigned char *)&header, (unsigned char *)&header+sizeof(header));
+	put_packed(out, codes);
+	std::vector<uint32_t> deltas(nverts);
+	for (int c=0; c<NCOMPONENTS; c++) {
+		if (!arrays[c]) continue;
+		float mn = INFINITY, mx = -INFINITY;
+		for (size_t v=0; v<nverts; v++) {
+			float x = arrays[c][v*strides[c]];
+			mn = std::min(mn, x);
+			mx = std::max(mx, x);
+		}
+		if (!nverts) mn = mx = 0.f;
+		uint32_t levels = (1u<<header.bits[c])-1;
+		float step = mx>mn ? (mx-mn)/levels : 0.f;
+		header.base[c] = mn;
+		header.step[c] = step;
+		uint16_t prev = 0;
+		for (size_t i=0; i<nverts; i++) {
+			float x = arrays[c][vertex_order[i]*strides[c]];
+			long qv = step>0.f ? lrintf((x-mn)/step) : 0;
+			uint16_t q = (uint16_t)std::min<long>(std::max<long>(qv, 0), levels);
+			deltas[i] = zigzag((uint32_t)q-prev, header.bits[c]);
+			prev = q;
+		}
+		put_packed(out, deltas);
+	}
+	memcpy(out.data(), &header, sizeof(header)); // base and step are known now
+	return true;
+}
+
+bool decode_mesh(const unsigned char *src, size_t srclen, Mesh &mesh) {
+	PackedHeader header;
+	if (srclen<sizeof(header)) {
+		std::cerr << "truncated packed mesh\n";
+		return false;
+	}
+	memcpy(&header, src, sizeof(header));
+	if (memcmp(header.magic, PACKED_MAGIC, sizeof(header.magic)) || header.version!=PACKED_VERSION
+		|| !(header.attributes & Mesh::POSITIONS)) {
+		std::cerr << "not a packed mesh\n";
+		return false;
+	}
+	// a group of 16 values takes at least a byte, so honest counts are bounded by the input size
+	bool sane = header.nindices%3==0 && header.nverts<=srclen*GROUP && header.nindices<=srclen*GROUP;
+	for (int c=0; c<NCOMPONENTS; c++) sane = sane && header.bits[c]<=16;
+	if (!sane) {
+		std::cerr << "bad packed mesh\n";
+		return false;
+	}
+	if (!mesh.allocate(header.nverts, header.nindices, header.attributes)) return false;
+	size_t nverts = header.nverts, nindices = header.nindices;
+
+	Reader in = {src+sizeof(header), src+srclen};
+	const unsigned char *p, *end;
+	alignas(16) uint32_t v[BLOCK*4] = {0};
+	bool ok = get_packed(in, nindices, p, end);
+	uint32_t *indices = mesh.get_indices();
+	uint32_t next = 0, bad = 0;
+	for (size_t i=0; ok && i<nindices; i+=BLOCK) {
+		size_t m = std::min<size_t>(BLOCK, nindices-i);
+		for (size_t g=0; ok && g<m; g+=GROUP) ok = (p = unpack_group(p, end, UNPACK_SINGLE, v+g))!=NULL;
+		if (ok) decode_indices(v, m, next, bad, indices+i);
+	}
+	// next passes nverts only after an index equal to it
+	ok = ok && !bad && next<=nverts;
+
+	// the components of an attribute decode side by side, a vertex at a time
+	const int first[4] = {0, 3, 5, NCOMPONENTS};
+	for (int attr=0; ok && attr<3; attr++) {
+		float *a = attr==0 ? mesh.get_positions() : (attr==1 ? mesh.get_texcoords() : mesh.get_normals());
+		if (!a) continue;
+		int n = first[attr+1]-first[attr];
+		const unsigned char *ps[3], *ends[3];
+		uint32_t prev[4] = {0}, mask[4] = {0};
+		float base[4] = {0}, step[4] = {0};
+		for (int c=0; ok && c<n; c++) {
+			int bits = header.bits[first[attr]+c];
+			ok = bits && get_packed(in, nverts, ps[c], ends[c]);
+			mask[c] = (1u<<bits)-1;
+			base[c] = header.base[first[attr]+c];
+			step[c] = header.step[first[attr]+c];
+		}
+		for (size_t i=0; ok && i<nverts; i+=BLOCK) {
+			size_t m = std::min<size_t>(BLOCK, nverts-i);
+			for (int c=0; c<n; c++) {
+				for (size_t g=0; ok && g<m; g+=GROUP) ok = (ps[c] = unpack_group(ps[c], ends[c], UNPACK_LANES, v+4*g+c))!=NULL;
+			}
+			if (ok) dequantize(v, m, n, prev, mask, base, step, a+i*n);
+		}
+	}
+	if (!ok) {
+		std::cerr << "corrupt packed mesh\n";
+		return false;
+	}
+	return true;
+}
+
+bool write_mesh_packed(const char *filename, const Mesh &mesh, const MeshCodecOptions &options) {
+	std::vector<unsigned char> packed;
+	if (!encode_mesh(mesh, packed, options)) return false;
+	std::ofstream out(filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	out.write((char *)packed.data(), (std::streamsize)packed.size());
+	if (!out.good()) {
+		std::cerr << "can't write the packed mesh " << filename << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool read_mesh_packed(const char *filename, Mesh &mesh) {
+	MappedFile file;
+	return file.open(filename) && decode_mesh(file.data(), file.size(), mesh);
+}
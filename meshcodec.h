@@ -0,0 +1,31 @@
+#ifndef __MESHCODEC_H__
+#define __MESHCODEC_H__
+
+#include <stddef.h>
+#include <vector>
+
+class Mesh;
+
+// Compact storage for meshes at rest. Triangles are put in vertex cache order
+// (Tipsify) and vertices renumbered by first use, indices are coded against the
+// next new vertex, attributes are quantized to the mesh bounds and delta coded
+// vertex to vertex, and every resulting stream is bit packed in byte aligned
+// groups of 16 at the width of their largest value, which decodes with shifts
+// and masks, fused with the dequantize in SSE2. Lossy in the attributes only: the
+// decoded mesh has the same triangles, reordered, with every component off by
+// at most half a quantization step, (max-min)/(2^bits-1)/2 of its range.
+struct MeshCodecOptions {
+	int position_bits; // 1..16 per component
+	int texcoord_bits; // 1..16 per component
+	int normal_bits;   // 1..16 per component
+	MeshCodecOptions() : position_bits(16), texcoord_bits(12), normal_bits(10) {
+	}
+};
+
+bool encode_mesh(const Mesh &mesh, std::vector<unsigned char> &out, const MeshCodecOptions &options=MeshCodecOptions());
+bool decode_mesh(const unsigned char *src, size_t srclen, Mesh &mesh);
+
+bool write_mesh_packed(const char *filename, const Mesh &mesh, const MeshCodecOptions &options=MeshCodecOptions());
+bool read_mesh_packed(const char *filename, Mesh &mesh);
+
+#endif //__MESHCODEC_H__
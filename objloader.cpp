@@ -0,0 +1,431 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <charconv>
+#include <string>
+#include <string.h>
+#include "objloader.h"
+#include "mesh.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+
+namespace {
+
+const size_t MIN_CHUNK = 1<<20;
+
+// A 'o' or 'g' line inside a chunk: faces from first_face on belong to a shape of that name.
+struct ObjGroup {
+	std::string name;
+	size_t first_face;
+};
+
+// One run of lines. The counting pass fills count; base is what all earlier chunks
+// hold, so the parse pass writes each element straight into its final slot and can
+// resolve negative indices on the spot.
+struct ObjChunk {
+	const char *begin;
+	const char *end;
+	ObjCounts count;
+	ObjCounts base;
+	ObjCounts done; // parsed so far
+	int attributes; // Mesh::Attribute mask, lines of other kinds are skipped
+	std::vector<ObjGroup> groups;
+	const char *error; // the offending line, NULL if the chunk parsed
+};
+
+// the whole-file arrays the parse pass writes into
+struct ObjArrays {
+	float *v, *vt, *vn;
+	tinyobj::index_t *indices;
+	unsigned char *num_face_vertices;
+};
+
+enum LineKind {
+	LINE_OTHER, LINE_V, LINE_VT, LINE_VN, LINE_F, LINE_GROUP
+};
+
+inline bool is_space(char c) {
+	return c==' ' || c=='\t' || c=='\r';
+}
+
+inline const char *skip_space(const char *p, const char *end) {
+	while (p<end && is_space(*p)) p++;
+	return p;
+}
+
+// from_chars reads straight out of the mapping: no terminator needed, no copy, no
+// locale, and the result is the correctly rounded float
+bool parse_float(const char *&p, const char *end, float &out) {
+	p = skip_space(p, end);
+	if (p<end && *p=='+') p++;
+	std::from_chars_result r = std::from_chars(p, end, out);
+	if (r.ec!=std::errc() || (r.ptr<end && !is_space(*r.ptr))) return false;
+	p = r.ptr;
+	return true;
+}
+
+bool parse_int(const char *&p, const char *end, int &out) {
+	bool negative = p<end && *p=='-';
+	if (negative || (p<end && *p=='+')) p++;
+	if (p>=end || *p<'0' || *p>'9') return false;
+	long long n = 0;
+	while (p<end && *p>='0' && *p<='9' && n<=0x7FFFFFFF) n = n*10+(*p++-'0');
+	if (n>0x7FFFFFFF) return false;
+	out = negative ? -(int)n : (int)n;
+	return true;
+}
+
+// p is past leading blanks, the line's payload starts at p+keyword_length(kind);
+// unwanted attributes classify as LINE_OTHER, so they are neither counted nor parsed
+LineKind line_kind(const char *p, const char *end, int attributes) {
+	if (end-p<2) return LINE_OTHER;
+	if (p[0]=='v' && is_space(p[1])) return LINE_V;
+	if (p[0]=='v' && p[1]=='t' && end-p>2 && is_space(p[2])) return attributes & Mesh::TEXCOORDS ? LINE_VT : LINE_OTHER;
+	if (p[0]=='v' && p[1]=='n' && end-p>2 && is_space(p[2])) return attributes & Mesh::NORMALS ? LINE_VN : LINE_OTHER;
+	if (p[0]=='f' && is_space(p[1])) return LINE_F;
+	if ((p[0]=='o' || p[0]=='g') && is_space(p[1])) return LINE_GROUP;
+	return LINE_OTHER; // comments, materials, smoothing groups and the rest are skipped
+}
+
+inline int keyword_length(LineKind kind) {
+	return kind==LINE_VT || kind==LINE_VN ? 3 : 2;
+}
+
+// corners on a face line, p is past the keyword
+size_t face_corners(const char *p, const char *end) {
+	size_t n = 0;
+	for (p = skip_space(p, end); p<end; p = skip_space(p, end)) {
+		n++;
+		while (p<end && !is_space(*p)) p++;
+	}
+	return n;
+}
+
+void count_chunk(ObjChunk &chunk) {
+	memset(&chunk.count, 0, sizeof(chunk.count));
+	for (const char *p = chunk.begin; p<chunk.end; ) {
+		const char *eol = (const char *)memchr(p, '\n', (size_t)(chunk.end-p));
+		if (!eol) eol = chunk.end;
+		p = skip_space(p, eol);
+		switch (line_kind(p, eol, chunk.attributes)) {
+		case LINE_V:  chunk.count.positions++; break;
+		case LINE_VT: chunk.count.texcoords++; break;
+		case LINE_VN: chunk.count.normals++; break;
+		case LINE_F: {
+			size_t n = face_corners(p+2, eol);
+			if (n>=3) { // degenerate faces are dropped, see parse_face()
+				chunk.count.faces++;
+				chunk.count.corners += n;
+			}
+			break;
+		}
+		default: break;
+		}
+		p = eol+1;
+	}
+}
+
+// OBJ indices are 1-based, or negative to count back from the latest element
+bool resolve_index(int raw, size_t count, int &out) {
+	if (raw>0) {
+		out = raw-1;
+	} else if (raw<0 && (size_t)-(long long)raw<=count) {
+		out = (int)((long long)count+raw);
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool parse_face(const char *p, const char *end, ObjChunk &chunk, const ObjArrays &out) {
+	size_t nv = chunk.base.positions+chunk.done.positions;
+	size_t nvt = chunk.base.texcoords+chunk.done.texcoords;
+	size_t nvn = chunk.base.normals+chunk.done.normals;
+	size_t first = chunk.done.corners;
+	tinyobj::index_t *corners = out.indices+chunk.base.corners;
+	// fewer than three corners make no polygon: skipped like tinyobj does, not an error
+	if (face_corners(p, end)<3) return true;
+	for (p = skip_space(p, end); p<end; p = skip_space(p, end)) {
+		if (chunk.done.corners==chunk.count.corners) return false;
+		tinyobj::index_t &idx = corners[chunk.done.corners++];
+		idx.vertex_index = idx.texcoord_index = idx.normal_index = -1;
+		int raw;
+		if (!parse_int(p, end, raw) || !resolve_index(raw, nv, idx.vertex_index)) return false;
+		if (p<end && *p=='/') {
+			p++;
+			if (p<end && *p!='/' && !is_space(*p)) {
+				if (!parse_int(p, end, raw)) return false;
+				if ((chunk.attributes & Mesh::TEXCOORDS) && !resolve_index(raw, nvt, idx.texcoord_index)) return false;
+			}
+			if (p<end && *p=='/') {
+				p++;
+				if (!parse_int(p, end, raw)) return false;
+				if ((chunk.attributes & Mesh::NORMALS) && !resolve_index(raw, nvn, idx.normal_index)) return false;
+			}
+		}
+		if (p<end && !is_space(*p)) return false;
+	}
+	size_t ncorners = chunk.done.corners-first;
+	if (ncorners<3 || ncorners>255 || chunk.done.faces==chunk.count.faces) return false;
+	out.num_face_vertices[chunk.base.faces+chunk.done.faces++] = (unsigned char)ncorners;
+	return true;
+}
+
+// missing trailing components read as 0 like tinyobj does, garbage fails the line
+bool parse_floats(const char *p, const char *end, int n, float *out) {
+	for (int i=0; i<n; i++) {
+		out[i] = 0.f;
+		if (skip_space(p, end)<end && !parse_float(p, end, out[i])) return false;
+	}
+	return true;
+}
+
+bool parse_line(const char *p, const char *end, ObjChunk &chunk, const ObjArrays &out) {
+	p = skip_space(p, end);
+	LineKind kind = line_kind(p, end, chunk.attributes);
+	p += keyword_length(kind);
+	ObjCounts &base = chunk.base, &done = chunk.done;
+	switch (kind) {
+	case LINE_V:
+		return done.positions<chunk.count.positions && parse_floats(p, end, 3, out.v+3*(base.positions+done.positions++));
+	case LINE_VT:
+		return done.texcoords<chunk.count.texcoords && parse_floats(p, end, 2, out.vt+2*(base.texcoords+done.texcoords++));
+	case LINE_VN:
+		return done.normals<chunk.count.normals && parse_floats(p, end, 3, out.vn+3*(base.normals+done.normals++));
+	case LINE_F:
+		return parse_face(p, end, chunk, out);
+	case LINE_GROUP: {
+		const char *name = skip_space(p, end), *stop = end;
+		while (stop>name && is_space(stop[-1])) stop--;
+		ObjGroup group = {std::string(name, stop), base.faces+done.faces};
+		chunk.groups.push_back(group);
+		return true;
+	}
+	default:
+		return true;
+	}
+}
+
+void parse_chunk(ObjChunk &chunk, const ObjArrays &out) {
+	memset(&chunk.done, 0, sizeof(chunk.done));
+	for (const char *p = chunk.begin; p<chunk.end; ) {
+		const char *eol = (const char *)memchr(p, '\n', (size_t)(chunk.end-p));
+		if (!eol) eol = chunk.end;
+		if (!parse_line(p, eol, chunk, out)) {
+			chunk.error = p;
+			return;
+		}
+		p = eol+1;
+	}
+}
+
+// cut at newlines into at most four chunks per thread, none much below MIN_CHUNK
+void split_chunks(const char *text, size_t size, size_t nthreads, int attributes, std::vector<ObjChunk> &chunks) {
+	const char *text_end = text+size;
+	size_t nchunks = std::max<size_t>(1, std::min<size_t>(size/MIN_CHUNK, nthreads*4));
+	chunks.resize(nchunks);
+	const char *p = text;
+	for (size_t i=0; i<nchunks; i++) {
+		const char *stop = i+1==nchunks ? text_end : text+size/nchunks*(i+1);
+		if (stop<p) stop = p;
+		const char *eol = (const char *)memchr(stop, '\n', (size_t)(text_end-stop));
+		stop = i+1==nchunks || !eol ? text_end : eol+1;
+		chunks[i].begin = p;
+		chunks[i].end = stop;
+		chunks[i].error = NULL;
+		chunks[i].attributes = attributes;
+		p = stop;
+	}
+}
+
+// sums the chunks' counts into total and gives each chunk its base
+void prefix_counts(std::vector<ObjChunk> &chunks, ObjCounts &total) {
+	memset(&total, 0, sizeof(total));
+	for (size_t i=0; i<chunks.size(); i++) {
+		ObjCounts &c = chunks[i].count;
+		chunks[i].base = total;
+		total.positions += c.positions;
+		total.texcoords += c.texcoords;
+		total.normals   += c.normals;
+		total.faces     += c.faces;
+		total.corners   += c.corners;
+	}
+}
+
+// load_obj_streaming() callbacks, they get raw OBJ indices: 1-based, negative or 0 for none
+struct StreamState {
+	MeshBuilder builder;
+	std::vector<int> v, t, n;
+	int attributes;
+	bool failed;
+};
+
+inline int resolve_raw(int raw, size_t count) {
+	return raw>0 ? raw-1 : (raw<0 ? (int)count+raw : -1);
+}
+
+void on_vertex(void *user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z, tinyobj::real_t) {
+	std::vector<float> &positions = ((StreamState *)user)->builder.positions;
+	positions.push_back(x);
+	positions.push_back(y);
+	positions.push_back(z);
+}
+
+void on_texcoord(void *user, tinyobj::real_t u, tinyobj::real_t v, tinyobj::real_t) {
+	std::vector<float> &texcoords = ((StreamState *)user)->builder.texcoords;
+	texcoords.push_back(u);
+	texcoords.push_back(v);
+}
+
+void on_normal(void *user, tinyobj::real_t x, tinyobj::real_t y, tinyobj::real_t z) {
+	std::vector<float> &normals = ((StreamState *)user)->builder.normals;
+	normals.push_back(x);
+	normals.push_back(y);
+	normals.push_back(z);
+}
+
+void on_face(void *user, tinyobj::index_t *indices, int ncorners) {
+	StreamState &st = *(StreamState *)user;
+	if (st.failed) return;
+	st.v.resize(ncorners);
+	st.t.resize(ncorners);
+	st.n.resize(ncorners);
+	for (int i=0; i<ncorners; i++) {
+		st.v[i] = resolve_raw(indices[i].vertex_index, st.builder.positions.size()/3);
+		st.t[i] = st.attributes & Mesh::TEXCOORDS ? resolve_raw(indices[i].texcoord_index, st.builder.texcoords.size()/2) : -1;
+		st.n[i] = st.attributes & Mesh::NORMALS ? resolve_raw(indices[i].normal_index, st.builder.normals.size()/3) : -1;
+	}
+	st.failed = !st.builder.add_face(st.v.data(), st.t.data(), st.n.data(), ncorners);
+}
+
+}
+
+bool count_obj(const char *filename, ObjCounts &counts, int attributes, ThreadPool *threads) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		return false;
+	}
+	if (!threads) threads = &ThreadPool::shared();
+	std::vector<ObjChunk> chunks;
+	split_chunks((const char *)file.data(), file.size(), threads->size()+1, attributes, chunks);
+	threads->parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; i++) {
+			count_chunk(chunks[i]);
+			file.release(chunks[i].begin, (size_t)(chunks[i].end-chunks[i].begin));
+		}
+	});
+	prefix_counts(chunks, counts);
+	return true;
+}
+
+bool load_obj_streaming(const char *filename, Mesh &mesh, int attributes, const ObjCounts *hint) {
+	std::vector<char> buffer(1<<20);
+	std::ifstream in;
+	in.rdbuf()->pubsetbuf(buffer.data(), (std::streamsize)buffer.size());
+	in.open(filename, std::ios::binary);
+	if (!in.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	tinyobj::callback_t callbacks;
+	// tinyobj still tokenizes the lines of dropped attributes, but nothing stores them
+	callbacks.vertex_cb = on_vertex;
+	callbacks.texcoord_cb = attributes & Mesh::TEXCOORDS ? on_texcoord : NULL;
+	callbacks.normal_cb = attributes & Mesh::NORMALS ? on_normal : NULL;
+	callbacks.index_cb = on_face;
+	StreamState st;
+	st.attributes = attributes;
+	st.failed = false;
+	if (hint) {
+		size_t ntriangles = hint->corners>2*hint->faces ? hint->corners-2*hint->faces : 0;
+		st.builder.reserve(hint->positions, hint->texcoords, hint->normals, hint->corners, ntriangles);
+	}
+	std::string warn, err;
+	bool ok = tinyobj::LoadObjWithCallback(in, callbacks, &st, NULL, &warn, &err);
+	if (!err.empty()) std::cerr << err;
+	if (!ok || st.failed) {
+		std::cerr << "can't load " << filename << "\n";
+		return false;
+	}
+	return st.builder.finish(mesh);
+}
+
+// Two passes over the mapping: a cheap parallel count of every line kind sizes all
+// arrays exactly, then the parallel parse writes each element in place. Apart from
+// group names and the shapes list, loading allocates a fixed number of times.
+bool load_obj_parallel(const char *filename, tinyobj::attrib_t &attrib, std::vector<tinyobj::shape_t> &shapes, int attributes, ThreadPool *threads) {
+	MappedFile file;
+	if (!file.open(filename)) {
+		return false;
+	}
+	if (!threads) threads = &ThreadPool::shared();
+
+	const char *text = (const char *)file.data(), *text_end = text+file.size();
+	std::vector<ObjChunk> chunks;
+	split_chunks(text, file.size(), threads->size()+1, attributes, chunks);
+	threads->parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; i++) {
+			count_chunk(chunks[i]);
+			// the mapped text would otherwise stay resident next to the arrays parsed from it
+			file.release(chunks[i].begin, (size_t)(chunks[i].end-chunks[i].begin));
+		}
+	});
+	ObjCounts total;
+	prefix_counts(chunks, total);
+
+	attrib = tinyobj::attrib_t();
+	attrib.vertices.resize(3*total.positions);
+	attrib.texcoords.resize(2*total.texcoords);
+	attrib.normals.resize(3*total.normals);
+	std::vector<tinyobj::index_t> indices(total.corners);
+	std::vector<unsigned char> num_face_vertices(total.faces);
+	ObjArrays out = {attrib.vertices.data(), attrib.texcoords.data(), attrib.normals.data(), indices.data(), num_face_vertices.data()};
+	threads->parallel_for(chunks.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; i++) {
+			parse_chunk(chunks[i], out);
+			file.release(chunks[i].begin, (size_t)(chunks[i].end-chunks[i].begin));
+		}
+	});
+	for (size_t i=0; i<chunks.size(); i++) {
+		ObjChunk &c = chunks[i];
+		if (!c.error && 0!=memcmp(&c.done, &c.count, sizeof(c.count))) {
+			c.error = c.begin; // can't happen unless the two passes disagree on a line
+		}
+		if (c.error) {
+			const char *eol = (const char *)memchr(c.error, '\n', (size_t)(text_end-c.error));
+			std::cerr << "can't parse line \"" << std::string(c.error, eol ? eol : text_end) << "\" in " << filename << "\n";
+			return false;
+		}
+	}
+
+	// Shapes split the face list at groups; a group with no faces only renames the
+	// shape, like in tinyobj. The usual single shape takes the arrays without a copy.
+	shapes.clear();
+	std::string name;
+	size_t face = 0, corner = 0, first_face = 0, first_corner = 0;
+	for (size_t i=0; i<=chunks.size(); i++) {
+		size_t ngroups = i<chunks.size() ? chunks[i].groups.size() : 1;
+		for (size_t g=0; g<ngroups; g++) {
+			size_t stop = i<chunks.size() ? chunks[i].groups[g].first_face : total.faces;
+			for (; face<stop; face++) corner += num_face_vertices[face];
+			if (stop>first_face) {
+				shapes.push_back(tinyobj::shape_t());
+				tinyobj::mesh_t &mesh = shapes.back().mesh;
+				shapes.back().name = name;
+				if (first_face==0 && stop==total.faces) {
+					mesh.indices.swap(indices);
+					mesh.num_face_vertices.swap(num_face_vertices);
+				} else {
+					mesh.indices.assign(indices.begin()+first_corner, indices.begin()+corner);
+					mesh.num_face_vertices.assign(num_face_vertices.begin()+first_face, num_face_vertices.begin()+stop);
+				}
+				mesh.material_ids.assign(stop-first_face, -1);
+				mesh.smoothing_group_ids.assign(stop-first_face, 0);
+			}
+			if (i<chunks.size()) name = chunks[i].groups[g].name;
+			first_face = stop;
+			first_corner = corner;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,40 @@
+#ifndef __OBJLOADER_H__
+#define __OBJLOADER_H__
+
+#include <vector>
+#include <tinyobjloader/tiny_obj_loader.h>
+#include "mesh.h"
+
+class ThreadPool;
+
+// Element counts of an OBJ file, see count_obj().
+struct ObjCounts {
+	size_t positions; // 'v' lines
+	size_t texcoords; // 'vt' lines
+	size_t normals;   // 'vn' lines
+	size_t faces;     // 'f' lines
+	size_t corners;   // vertices over all faces
+};
+
+// A quick parallel pass over the mapped file counting lines by kind, without
+// parsing any number. Lets loaders size their arrays exactly up front.
+bool count_obj(const char *filename, ObjCounts &counts, int attributes=Mesh::ALL_ATTRIBUTES, ThreadPool *threads=NULL);
+
+// The loaders take a Mesh::Attribute mask of what to keep; positions always are.
+// Lines of the other kinds are skipped without storage and face corners referencing
+// them get -1.
+
+// Parallel OBJ reader. The file is mapped and cut at line boundaries into chunks
+// that are parsed concurrently, then stitched together with relative (negative)
+// indices resolved against the whole file. Produces the positions, texcoords,
+// normals and faces tinyobj::LoadObj does without triangulation, one shape per
+// 'o'/'g' group; materials, vertex colors, lines and points are not read.
+bool load_obj_parallel(const char *filename, tinyobj::attrib_t &attrib, std::vector<tinyobj::shape_t> &shapes, int attributes=Mesh::ALL_ATTRIBUTES, ThreadPool *threads=NULL);
+
+// Single-threaded OBJ reader on top of tinyobj::LoadObjWithCallback that welds
+// straight into a Mesh as lines stream by, without the intermediate attrib_t and
+// shape_t copies, so peak memory is about half that of loading then building.
+// With counts from count_obj() every array is reserved once instead of regrown.
+bool load_obj_streaming(const char *filename, Mesh &mesh, int attributes=Mesh::ALL_ATTRIBUTES, const ObjCounts *hint=NULL);
+
+#endif //__OBJLOADER_H__
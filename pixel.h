@@ -0,0 +1,96 @@
+#ifndef __PIXEL_H__
+#define __PIXEL_H__
+
+#include <stddef.h>
+
+// SSE2 is baseline on x86-64; elsewhere the scalar paths are used.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#include <emmintrin.h>
+#define TGA_SSE2
+#endif
+
+// Packed 32-bit BGRA pixel, the same byte order TGA stores on disk. Unlike
+// TGAColor it carries no bytespp, so it fits in a register and copies as one word.
+struct Pixel32 {
+	unsigned char b, g, r, a;
+
+	Pixel32() : b(0), g(0), r(0), a(0) {
+	}
+
+	Pixel32(unsigned char R, unsigned char G, unsigned char B, unsigned char A=255) : b(B), g(G), r(R), a(A) {
+	}
+
+	// b in the low byte, i.e. the same value as TGAColor::val on little-endian hosts
+	unsigned int bits() const {
+		return b | (g<<8) | (r<<16) | ((unsigned int)a<<24);
+	}
+
+	static Pixel32 from_bits(unsigned int v) {
+		return Pixel32(v>>16, v>>8, v, v>>24);
+	}
+
+	// scales the color channels and keeps alpha, truncating like TGAColor's unsigned char *= float
+	Pixel32 scaled(float k) const {
+		return Pixel32((unsigned char)(r*k), (unsigned char)(g*k), (unsigned char)(b*k), a);
+	}
+};
+
+static_assert(sizeof(Pixel32)==4, "Pixel32 must be packed into 32 bits");
+
+// Pixel formats. Each knows its size and how to move a Pixel32 in and out of
+// memory, so code templated on them has no per-pixel switch on bytespp.
+struct Gray8 {
+	enum { bytespp = 1 };
+	static Pixel32 load(const unsigned char *p) { Pixel32 c; c.b = p[0]; return c; }
+	static void store(unsigned char *p, Pixel32 c) { p[0] = c.b; }
+};
+
+struct RGB8 {
+	enum { bytespp = 3 };
+	static Pixel32 load(const unsigned char *p) { return Pixel32(p[2], p[1], p[0], 0); }
+	static void store(unsigned char *p, Pixel32 c) { p[0] = c.b; p[1] = c.g; p[2] = c.r; }
+};
+
+struct RGBA8 {
+	enum { bytespp = 4 };
+	static Pixel32 load(const unsigned char *p) { return Pixel32(p[2], p[1], p[0], p[3]); }
+	static void store(unsigned char *p, Pixel32 c) { p[0] = c.b; p[1] = c.g; p[2] = c.r; p[3] = c.a; }
+};
+
+// Non-owning, format-typed window onto an image buffer. load/store are unchecked;
+// get/set clip to the image like TGAImage::get/set.
+template <class Fmt> class ImageView {
+	unsigned char *data;
+	int width;
+	int height;
+	ptrdiff_t stride; // bytes between rows
+public:
+	typedef Fmt format;
+
+	ImageView() : data(NULL), width(0), height(0), stride(0) {
+	}
+
+	ImageView(unsigned char *d, int w, int h, ptrdiff_t s) : data(d), width(w), height(h), stride(s) {
+	}
+
+	unsigned char *row(int y) const { return data+y*stride; }
+	Pixel32 load(int x, int y) const { return Fmt::load(row(y)+x*Fmt::bytespp); }
+	void store(int x, int y, Pixel32 c) const { Fmt::store(row(y)+x*Fmt::bytespp, c); }
+
+	Pixel32 get(int x, int y) const {
+		if (!data || x<0 || y<0 || x>=width || y>=height) return Pixel32();
+		return load(x, y);
+	}
+
+	bool set(int x, int y, Pixel32 c) const {
+		if (!data || x<0 || y<0 || x>=width || y>=height) return false;
+		store(x, y, c);
+		return true;
+	}
+
+	int get_width() const { return width; }
+	int get_height() const { return height; }
+	ptrdiff_t get_stride() const { return stride; }
+};
+
+#endif //__PIXEL_H__
@@ -0,0 +1,63 @@
+#include <iostream>
+#include <string.h>
+#include "pyramid.h"
+#include "resample.h"
+#include "tgastream.h"
+
+struct PyramidLevel {
+	TGAStreamWriter writer;
+	int width;
+	int height;
+	std::vector<unsigned char> pending; // even row waiting for its partner
+	std::vector<unsigned char> row;     // row just produced from the level above
+	bool has_pending;
+};
+
+bool write_tga_pyramid(TGAImage &img, const std::vector<std::string> &filenames, bool rle) {
+	int bpp = img.get_bytespp();
+	int nlevels = (int)filenames.size();
+	if (!img.buffer() || !nlevels) return false;
+	std::vector<PyramidLevel> levels(nlevels);
+	int w = img.get_width(), h = img.get_height();
+	for (int i=0; i<nlevels; i++) {
+		if (w<=0 || h<=0) {
+			std::cerr << "too many pyramid levels for " << img.get_width() << "x" << img.get_height() << "\n";
+			return false;
+		}
+		PyramidLevel &level = levels[i];
+		level.width = w;
+		level.height = h;
+		level.pending.resize((size_t)w*bpp);
+		level.row.resize((size_t)w*bpp);
+		level.has_pending = false;
+		if (!level.writer.open(filenames[i].c_str(), w, h, bpp, img.get_origin(), rle))
+			return false;
+		w /= 2;
+		h /= 2;
+	}
+
+	bool ok = true;
+	for (int y=0; y<img.get_height() && ok; y++) {
+		// feed the row down the chain as far as it completes row pairs
+		const unsigned char *row = img.row(y);
+		for (int i=0; i<nlevels && row; i++) {
+			PyramidLevel &level = levels[i];
+			if (level.writer.rows_left()>0)
+				ok = ok && level.writer.write_row(row);
+			if (i+1==nlevels) break;
+			if (!level.has_pending) {
+				memcpy(level.pending.data(), row, level.pending.size());
+				level.has_pending = true;
+				row = NULL;
+			} else {
+				PyramidLevel &next = levels[i+1];
+				downsample2x_row(level.pending.data(), row, next.row.data(), next.width, bpp);
+				level.has_pending = false;
+				row = next.row.data();
+			}
+		}
+	}
+	for (int i=0; i<nlevels; i++)
+		ok = levels[i].writer.close() && ok;
+	return ok;
+}
@@ -0,0 +1,14 @@
+#ifndef __PYRAMID_H__
+#define __PYRAMID_H__
+
+#include <string>
+#include <vector>
+#include "tgaimage.h"
+
+// Writes img to filenames[0] and successive 2x box downsamples of it to filenames[1], ...
+// in a single pass over img's rows: each pair of rows of a level immediately becomes one
+// row of the next, and every row is RLE encoded as soon as it exists, so no level is
+// ever held in full. Odd trailing rows/columns are dropped, like downsample_box.
+bool write_tga_pyramid(TGAImage &img, const std::vector<std::string> &filenames, bool rle=true);
+
+#endif //__PYRAMID_H__
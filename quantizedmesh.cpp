@@ -0,0 +1,147 @@
+#include <iostream>
+#include <algorithm>
+#include <math.h>
+#include "quantizedmesh.h"
+#include "mesh.h"
+
+namespace {
+
+const float UNORM16 = 65535.f;
+const float SNORM16 = 32767.f;
+
+// base and step so that base + q*step, q in 0..65535, spans [lo, hi]
+void unorm_range(float lo, float hi, float &base, float &step) {
+	base = lo;
+	step = hi>lo ? (hi-lo)/UNORM16 : 0.f;
+}
+
+uint16_t to_unorm(float x, float base, float step) {
+	if (step<=0.f) return 0;
+	return (uint16_t)std::min(std::max(lrintf((x-base)/step), 0L), 65535L);
+}
+
+float sign_of(float x) {
+	return x<0.f ? -1.f : 1.f;
+}
+
+// octahedral mapping: project onto |x|+|y|+|z| = 1 and fold the lower half over the diagonals
+void oct_encode(const float n[3], int16_t out[2]) {
+	float l1 = fabsf(n[0])+fabsf(n[1])+fabsf(n[2]);
+	if (l1<=0.f) {
+		out[0] = out[1] = 0;
+		return;
+	}
+	float x = n[0]/l1, y = n[1]/l1;
+	if (n[2]<0.f) {
+		float fx = (1.f-fabsf(y))*sign_of(x);
+		y = (1.f-fabsf(x))*sign_of(y);
+		x = fx;
+	}
+	out[0] = (int16_t)lrintf(std::min(std::max(x, -1.f), 1.f)*SNORM16);
+	out[1] = (int16_t)lrintf(std::min(std::max(y, -1.f), 1.f)*SNORM16);
+}
+
+void oct_decode(const int16_t in[2], float n[3]) {
+	float x = std::max(in[0]/SNORM16, -1.f), y = std::max(in[1]/SNORM16, -1.f);
+	float z = 1.f-fabsf(x)-fabsf(y);
+	if (z<0.f) {
+		float fx = (1.f-fabsf(y))*sign_of(x);
+		y = (1.f-fabsf(x))*sign_of(y);
+		x = fx;
+	}
+	float len = sqrtf(x*x+y*y+z*z);
+	n[0] = x/len;
+	n[1] = y/len;
+	n[2] = z/len;
+}
+
+}
+
+QuantizedMesh::QuantizedMesh() : attributes(0) {
+	clear();
+}
+
+void QuantizedMesh::clear() {
+	std::vector<uint16_t>().swap(positions);
+	std::vector<uint16_t>().swap(texcoords);
+	std::vector<int16_t>().swap(normals);
+	std::vector<uint32_t>().swap(indices);
+	for (int i=0; i<4; i++) position_base[i] = position_step[i] = 0.f;
+	for (int i=0; i<2; i++) texcoord_base[i] = texcoord_step[i] = 0.f;
+	for (int i=0; i<3; i++) errors[i] = 0.f;
+	attributes = 0;
+}
+
+bool QuantizedMesh::quantize(const Mesh &mesh, const QuantizeBounds &bounds) {
+	clear();
+	size_t nverts = mesh.get_nverts();
+	const float *p = mesh.get_positions(), *t = mesh.get_texcoords(), *n = mesh.get_normals();
+
+	float lo[3] = {INFINITY, INFINITY, INFINITY}, hi[3] = {-INFINITY, -INFINITY, -INFINITY};
+	for (size_t v=0; v<nverts; v++) {
+		for (int i=0; i<3; i++) {
+			lo[i] = std::min(lo[i], p[3*v+i]);
+			hi[i] = std::max(hi[i], p[3*v+i]);
+		}
+	}
+	positions.resize(nverts*4);
+	for (int i=0; i<3 && nverts; i++) unorm_range(lo[i], hi[i], position_base[i], position_step[i]);
+	for (size_t v=0; v<nverts; v++) {
+		for (int i=0; i<3; i++) positions[4*v+i] = to_unorm(p[3*v+i], position_base[i], position_step[i]);
+		positions[4*v+3] = 0;
+	}
+
+	if (t) {
+		float tlo[2] = {INFINITY, INFINITY}, thi[2] = {-INFINITY, -INFINITY};
+		for (size_t v=0; v<nverts; v++) {
+			for (int i=0; i<2; i++) {
+				tlo[i] = std::min(tlo[i], t[2*v+i]);
+				thi[i] = std::max(thi[i], t[2*v+i]);
+			}
+		}
+		for (int i=0; i<2 && nverts; i++) unorm_range(tlo[i], thi[i], texcoord_base[i], texcoord_step[i]);
+		texcoords.resize(nverts*2);
+		for (size_t v=0; v<nverts; v++) {
+			for (int i=0; i<2; i++) texcoords[2*v+i] = to_unorm(t[2*v+i], texcoord_base[i], texcoord_step[i]);
+		}
+	}
+	if (n) {
+		normals.resize(nverts*2);
+		for (size_t v=0; v<nverts; v++) oct_encode(n+3*v, &normals[2*v]);
+	}
+	indices.assign(mesh.get_indices(), mesh.get_indices()+mesh.get_nindices());
+	attributes = mesh.get_attributes();
+
+	// measured through the getters the renderer uses, so the bound holds for what it sees
+	for (size_t v=0; v<nverts; v++) {
+		float q[4];
+		get_position(v, q);
+		for (int i=0; i<3; i++) errors[0] = std::max(errors[0], fabsf(q[i]-p[3*v+i]));
+		if (t) {
+			get_texcoord(v, q);
+			for (int i=0; i<2; i++) errors[1] = std::max(errors[1], fabsf(q[i]-t[2*v+i]));
+		}
+		float len = n ? sqrtf(n[3*v]*n[3*v]+n[3*v+1]*n[3*v+1]+n[3*v+2]*n[3*v+2]) : 0.f;
+		if (len>0.f) {
+			get_normal(v, q);
+			float d = 0.f;
+			for (int i=0; i<3; i++) d += (q[i]-n[3*v+i]/len)*(q[i]-n[3*v+i]/len);
+			errors[2] = std::max(errors[2], sqrtf(d));
+		}
+	}
+	if (errors[0]>bounds.position || errors[1]>bounds.texcoord || errors[2]>bounds.normal) {
+		std::cerr << "16-bit quantization misses the error bound: position " << errors[0]
+			<< ", texcoord " << errors[1] << ", normal " << errors[2] << "\n";
+		clear();
+		return false;
+	}
+	return true;
+}
+
+size_t QuantizedMesh::vertex_bytes() const {
+	return positions.size()*sizeof(uint16_t)+texcoords.size()*sizeof(uint16_t)+normals.size()*sizeof(int16_t);
+}
+
+void QuantizedMesh::get_normal(size_t v, float out[3]) const {
+	oct_decode(&normals[2*v], out);
+}
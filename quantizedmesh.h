@@ -0,0 +1,80 @@
+#ifndef __QUANTIZEDMESH_H__
+#define __QUANTIZEDMESH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "pixel.h" // TGA_SSE2
+
+class Mesh;
+
+// Largest error quantize() accepts per attribute, measured on the dequantized
+// values: model units for positions, uv units for texcoords, and the distance
+// between unit vectors (about the angle in radians) for normals.
+struct QuantizeBounds {
+	float position;
+	float texcoord;
+	float normal;
+	QuantizeBounds() : position(1e30f), texcoord(1e30f), normal(1e30f) {
+	}
+};
+
+// Compact vertex data for renders bound by vertex fetch: positions are 16-bit
+// unorm over the mesh bounding box (x y z and a pad, 8 bytes a vertex instead of
+// 12), uvs 16-bit unorm over their range, normals octahedral in two 16-bit snorms.
+// The getters dequantize one vertex with a multiply-add, in SSE2 where available.
+class QuantizedMesh {
+protected:
+	std::vector<uint16_t> positions; // x y z 0 per vertex
+	std::vector<uint16_t> texcoords; // u v per vertex, empty without TEXCOORDS
+	std::vector<int16_t> normals;    // octahedral x y per vertex, empty without NORMALS
+	std::vector<uint32_t> indices;
+	float position_base[4], position_step[4]; // value = base + q*step, w unused
+	float texcoord_base[2], texcoord_step[2];
+	float errors[3]; // measured position, texcoord and normal error
+	int attributes;
+public:
+	QuantizedMesh();
+	// false, leaving the mesh empty, when the source exceeds a bound
+	bool quantize(const Mesh &mesh, const QuantizeBounds &bounds=QuantizeBounds());
+	void clear();
+
+	size_t get_nverts() const { return positions.size()/4; }
+	size_t get_nindices() const { return indices.size(); }
+	size_t get_ntriangles() const { return indices.size()/3; }
+	int get_attributes() const { return attributes; }
+	const uint32_t *get_indices() const { return indices.data(); }
+	float get_position_error() const { return errors[0]; }
+	float get_texcoord_error() const { return errors[1]; }
+	float get_normal_error() const { return errors[2]; }
+	size_t vertex_bytes() const; // every attribute array, for comparing with the float layout
+
+	// xyz into out[0..2], out[3] is scratch so the store can be one vector wide
+	void get_position(size_t v, float out[4]) const {
+#ifdef TGA_SSE2
+		__m128i q = _mm_loadl_epi64((const __m128i *)&positions[4*v]);
+		__m128 f = _mm_cvtepi32_ps(_mm_unpacklo_epi16(q, _mm_setzero_si128()));
+		_mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(f, _mm_loadu_ps(position_step)), _mm_loadu_ps(position_base)));
+#else
+		for (int i=0; i<4; i++) out[i] = position_base[i]+positions[4*v+i]*position_step[i];
+#endif
+	}
+
+	void get_texcoord(size_t v, float out[2]) const {
+#ifdef TGA_SSE2
+		int32_t packed;
+		memcpy(&packed, &texcoords[2*v], sizeof(packed));
+		__m128 f = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_cvtsi32_si128(packed), _mm_setzero_si128()));
+		__m128 step = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)texcoord_step));
+		__m128 base = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)texcoord_base));
+		_mm_storel_pi((__m64 *)out, _mm_add_ps(_mm_mul_ps(f, step), base));
+#else
+		for (int i=0; i<2; i++) out[i] = texcoord_base[i]+texcoords[2*v+i]*texcoord_step[i];
+#endif
+	}
+
+	void get_normal(size_t v, float out[3]) const;
+};
+
+#endif //__QUANTIZEDMESH_H__
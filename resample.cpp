@@ -0,0 +1,238 @@
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include "resample.h"
+#include "threadpool.h"
+
+// Four float channels of one pixel (b, g, r, a), one SSE register when available.
+struct F4 {
+#ifdef TGA_SSE2
+	__m128 v;
+	static F4 zero() { F4 r; r.v = _mm_setzero_ps(); return r; }
+	static F4 load(const unsigned char *p, int bpp) {
+		unsigned int bits = 0;
+		memcpy(&bits, p, bpp);
+		__m128i x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)bits), _mm_setzero_si128()), _mm_setzero_si128());
+		F4 r; r.v = _mm_cvtepi32_ps(x); return r;
+	}
+	void madd(const F4 &p, float w) { v = _mm_add_ps(v, _mm_mul_ps(p.v, _mm_set1_ps(w))); }
+	void store(unsigned char *p, int bpp) const {
+		// round, then clamp to 0..255 via the saturating packs
+		__m128i x = _mm_cvtps_epi32(v);
+		x = _mm_packs_epi32(x, x);
+		x = _mm_packus_epi16(x, x);
+		unsigned int bits = (unsigned int)_mm_cvtsi128_si32(x);
+		memcpy(p, &bits, bpp);
+	}
+#else
+	float v[4];
+	static F4 zero() { F4 r; r.v[0] = r.v[1] = r.v[2] = r.v[3] = 0.f; return r; }
+	static F4 load(const unsigned char *p, int bpp) {
+		F4 r = zero();
+		for (int c=0; c<bpp; c++) r.v[c] = p[c];
+		return r;
+	}
+	void madd(const F4 &p, float w) { for (int c=0; c<4; c++) v[c] += p.v[c]*w; }
+	void store(unsigned char *p, int bpp) const {
+		for (int c=0; c<bpp; c++) {
+			float x = floorf(v[c]+.5f);
+			p[c] = (unsigned char)(x<0.f ? 0.f : (x>255.f ? 255.f : x));
+		}
+	}
+#endif
+};
+
+static float filter_support(ResampleFilter filter) {
+	switch (filter) {
+		case RESAMPLE_BOX:      return .5f;
+		case RESAMPLE_BILINEAR: return 1.f;
+		case RESAMPLE_LANCZOS3: return 3.f;
+	}
+	return 1.f;
+}
+
+static float filter_weight(ResampleFilter filter, float x) {
+	const float pi = 3.14159265358979f;
+	x = fabsf(x);
+	switch (filter) {
+		case RESAMPLE_BOX:
+			return x<.5f ? 1.f : 0.f;
+		case RESAMPLE_BILINEAR:
+			return x<1.f ? 1.f-x : 0.f;
+		case RESAMPLE_LANCZOS3:
+			if (x<1e-6f) return 1.f;
+			if (x>=3.f) return 0.f;
+			return 3.f*sinf(pi*x)*sinf(pi*x/3.f)/(pi*pi*x*x);
+	}
+	return 0.f;
+}
+
+// Source taps of every destination sample along one axis.
+struct Taps {
+	std::vector<int> first; // first source index of each destination sample
+	std::vector<int> count;
+	std::vector<float> weights; // count[i] weights per sample, padded to max_count
+	int max_count;
+
+	Taps(int src_len, int dst_len, ResampleFilter filter) {
+		float scale   = (float)dst_len/src_len;
+		float widen   = scale<1.f ? 1.f/scale : 1.f; // stretch the kernel when minifying
+		float support = filter_support(filter)*widen;
+		max_count = (int)ceilf(support*2.f)+1;
+		first.resize(dst_len);
+		count.resize(dst_len);
+		weights.assign((size_t)dst_len*max_count, 0.f);
+		for (int i=0; i<dst_len; i++) {
+			float center = (i+.5f)/scale;
+			// source samples j whose centers j+.5 lie strictly inside center +- support
+			int lo = std::max(0, (int)floorf(center-support-.5f)+1);
+			int hi = std::min(src_len-1, (int)ceilf(center+support-.5f)-1);
+			float *w = &weights[(size_t)i*max_count];
+			float total = 0.f;
+			int n = 0;
+			for (int j=lo; j<=hi && n<max_count; j++, n++) {
+				w[n] = filter_weight(filter, (j+.5f-center)/widen);
+				total += w[n];
+			}
+			if (total==0.f) { // can't happen with these kernels, but stay defined
+				lo = std::min(src_len-1, std::max(0, (int)center));
+				n = 1;
+				w[0] = total = 1.f;
+			}
+			for (int k=0; k<n; k++) w[k] /= total;
+			first[i] = lo;
+			count[i] = n;
+		}
+	}
+};
+
+template <class F> static void for_rows(ThreadPool *threads, int nrows, F f) {
+	if (!threads || threads->size()<2) {
+		f(0, nrows);
+		return;
+	}
+	size_t band = nrows/(threads->size()*4)+1;
+	threads->parallel_for(nrows, band, [&](size_t y0, size_t y1) { f((int)y0, (int)y1); });
+}
+
+bool resample(TGAImage &src, TGAImage &dst, ResampleFilter filter, ThreadPool *threads) {
+	int sw = src.get_width(), sh = src.get_height(), bpp = src.get_bytespp();
+	int dw = dst.get_width(), dh = dst.get_height();
+	if (!src.buffer() || !dst.buffer() || bpp!=dst.get_bytespp() || sw<=0 || sh<=0 || dw<=0 || dh<=0) {
+		std::cerr << "can't resample into a different format or an empty image\n";
+		return false;
+	}
+	Taps htaps(sw, dw, filter);
+	Taps vtaps(sh, dh, filter);
+
+	// horizontal pass: every source row to dw float pixels
+	std::vector<F4> tmp((size_t)dw*sh);
+	for_rows(threads, sh, [&](int y0, int y1) {
+		for (int y=y0; y<y1; y++) {
+			const unsigned char *in = src.row(y);
+			F4 *out = &tmp[(size_t)y*dw];
+			for (int x=0; x<dw; x++) {
+				const float *w = &htaps.weights[(size_t)x*htaps.max_count];
+				const unsigned char *p = in+(size_t)htaps.first[x]*bpp;
+				F4 acc = F4::zero();
+				for (int k=0; k<htaps.count[x]; k++, p+=bpp)
+					acc.madd(F4::load(p, bpp), w[k]);
+				out[x] = acc;
+			}
+		}
+	});
+
+	// vertical pass: weighted sums of whole float rows, so the inner loop is contiguous
+	for_rows(threads, dh, [&](int y0, int y1) {
+		std::vector<F4> acc(dw);
+		for (int y=y0; y<y1; y++) {
+			std::fill(acc.begin(), acc.end(), F4::zero());
+			const float *w = &vtaps.weights[(size_t)y*vtaps.max_count];
+			for (int k=0; k<vtaps.count[y]; k++) {
+				const F4 *in = &tmp[(size_t)(vtaps.first[y]+k)*dw];
+				for (int x=0; x<dw; x++)
+					acc[x].madd(in[x], w[k]);
+			}
+			unsigned char *out = dst.row(y);
+			for (int x=0; x<dw; x++)
+				acc[x].store(out+(size_t)x*bpp, bpp);
+		}
+	});
+	dst.set_origin(src.get_origin());
+	return true;
+}
+
+// Sums n rows byte by byte into 16 bit lanes; the part that vectorizes for any bpp.
+static void sum_rows(const unsigned char **rows, int n, unsigned short *sum, size_t nbytes) {
+	size_t i = 0;
+#ifdef TGA_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; i+16<=nbytes; i+=16) {
+		__m128i lo = zero, hi = zero;
+		for (int r=0; r<n; r++) {
+			__m128i x = _mm_loadu_si128((const __m128i *)(rows[r]+i));
+			lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(x, zero));
+			hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(x, zero));
+		}
+		_mm_storeu_si128((__m128i *)(sum+i),   lo);
+		_mm_storeu_si128((__m128i *)(sum+i+8), hi);
+	}
+#endif
+	for (; i<nbytes; i++) {
+		unsigned short s = 0;
+		for (int r=0; r<n; r++) s += rows[r][i];
+		sum[i] = s;
+	}
+}
+
+// Folds factor neighbouring pixels of a row of column sums into one, rounding to nearest.
+static void fold_columns(const unsigned short *sum, unsigned char *dst, int dst_width, int bpp, int factor) {
+	int shift = 2==factor ? 2 : 4; // factor*factor samples per output pixel
+	int half  = 1<<(shift-1);
+	for (int x=0; x<dst_width; x++) {
+		const unsigned short *s = sum+(size_t)x*factor*bpp;
+		for (int c=0; c<bpp; c++) {
+			unsigned int t = half;
+			for (int k=0; k<factor; k++) t += s[k*bpp+c];
+			dst[(size_t)x*bpp+c] = (unsigned char)(t>>shift);
+		}
+	}
+}
+
+void downsample2x_row(const unsigned char *row0, const unsigned char *row1, unsigned char *dst, int dst_width, int bytespp) {
+	const unsigned char *rows[2] = {row0, row1};
+	size_t nbytes = (size_t)dst_width*2*bytespp;
+	unsigned short stackbuf[2048];
+	std::vector<unsigned short> heapbuf;
+	unsigned short *sum = stackbuf;
+	if (nbytes>2048) {
+		heapbuf.resize(nbytes);
+		sum = heapbuf.data();
+	}
+	sum_rows(rows, 2, sum, nbytes);
+	fold_columns(sum, dst, dst_width, bytespp, 2);
+}
+
+bool downsample_box(TGAImage &src, TGAImage &dst, int factor, ThreadPool *threads) {
+	int bpp = src.get_bytespp();
+	int dw = dst.get_width(), dh = dst.get_height();
+	if ((2!=factor && 4!=factor) || !src.buffer() || !dst.buffer() || bpp!=dst.get_bytespp() ||
+		dw!=src.get_width()/factor || dh!=src.get_height()/factor) {
+		std::cerr << "bad box downsample target\n";
+		return false;
+	}
+	for_rows(threads, dh, [&](int y0, int y1) {
+		size_t nbytes = (size_t)dw*factor*bpp;
+		std::vector<unsigned short> sum(nbytes);
+		const unsigned char *rows[4];
+		for (int y=y0; y<y1; y++) {
+			for (int r=0; r<factor; r++) rows[r] = src.row(y*factor+r);
+			sum_rows(rows, factor, sum.data(), nbytes);
+			fold_columns(sum.data(), dst.row(y), dw, bpp, factor);
+		}
+	});
+	dst.set_origin(src.get_origin());
+	return true;
+}
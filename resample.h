@@ -0,0 +1,26 @@
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include "tgaimage.h"
+
+class ThreadPool;
+
+// Filtered image resizing, the quality replacement for TGAImage::scale (nearest neighbour).
+
+enum ResampleFilter {
+	RESAMPLE_BOX, RESAMPLE_BILINEAR, RESAMPLE_LANCZOS3
+};
+
+// Resamples src into dst, which must already have the target size and src's format.
+// Separable: a horizontal pass into a float buffer, then a vertical pass, both split
+// over rows on threads when given. Filters widen when minifying, so downscales average.
+bool resample(TGAImage &src, TGAImage &dst, ResampleFilter filter, ThreadPool *threads=NULL);
+
+// Exact box downsample by 2 or 4 in integer math, for supersample resolves and mip chains.
+// dst must be src's size divided by factor (rounded down) in src's format.
+bool downsample_box(TGAImage &src, TGAImage &dst, int factor, ThreadPool *threads=NULL);
+
+// One output row of a 2x box downsample from two source rows; dst gets dst_width pixels.
+void downsample2x_row(const unsigned char *row0, const unsigned char *row1, unsigned char *dst, int dst_width, int bytespp);
+
+#endif //__RESAMPLE_H__
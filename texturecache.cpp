@@ -0,0 +1,76 @@
+#include <filesystem>
+#include "texturecache.h"
+#include "threadpool.h"
+
+TextureCache::TextureCache(ThreadPool &threads) : threads(threads) {
+}
+
+TGAImage *TextureCache::Handle::get() const {
+	if (!entry || !entry->ready.get()) return NULL;
+	return &entry->image;
+}
+
+TextureCache::Handle TextureCache::request(const char *filename) {
+	Handle handle;
+	if (!filename || !*filename) return handle;
+	// "obj/./a.tga" and "obj/a.tga" are the same texture
+	std::string key = std::filesystem::path(filename).lexically_normal().generic_string();
+
+	std::lock_guard<std::mutex> lock(mtx);
+	std::shared_ptr<Entry> &entry = entries[key];
+	if (!entry) {
+		entry = std::make_shared<Entry>();
+		// weak, since the future keeps the task alive; while decoding the task holds the
+		// entry, so trim() can't free the image under it
+		std::weak_ptr<Entry> weak = entry;
+		ThreadPool *pool = &threads;
+		entry->ready = threads.submit([weak, key, pool]() {
+			std::shared_ptr<Entry> e = weak.lock();
+			return e && e->image.map_tga_file(key.c_str(), pool);
+		}).share();
+	}
+	handle.entry = entry;
+	return handle;
+}
+
+std::vector<TextureCache::Handle> TextureCache::request_materials(const std::vector<tinyobj::material_t> &materials, const char *base_path) {
+	std::vector<Handle> handles;
+	std::string base = base_path ? base_path : "";
+	for (size_t i=0; i<materials.size(); i++) {
+		const tinyobj::material_t &m = materials[i];
+		const std::string *maps[] = {&m.ambient_texname, &m.diffuse_texname, &m.specular_texname, &m.specular_highlight_texname,
+			&m.bump_texname, &m.displacement_texname, &m.alpha_texname, &m.normal_texname};
+		for (size_t k=0; k<sizeof(maps)/sizeof(maps[0]); k++) {
+			if (maps[k]->empty()) continue;
+			Handle h = request((base+*maps[k]).c_str());
+			bool seen = false;
+			for (size_t j=0; j<handles.size() && !seen; j++) seen = handles[j].entry==h.entry;
+			if (!seen) handles.push_back(h);
+		}
+	}
+	return handles;
+}
+
+size_t TextureCache::size() {
+	std::lock_guard<std::mutex> lock(mtx);
+	return entries.size();
+}
+
+size_t TextureCache::trim() {
+	std::lock_guard<std::mutex> lock(mtx);
+	size_t n = 0;
+	for (auto it=entries.begin(); it!=entries.end();) {
+		if (it->second.use_count()==1) {
+			it = entries.erase(it);
+			n++;
+		} else {
+			++it;
+		}
+	}
+	return n;
+}
+
+TextureCache &TextureCache::shared() {
+	static TextureCache cache(ThreadPool::shared());
+	return cache;
+}
@@ -0,0 +1,52 @@
+#ifndef __TEXTURECACHE_H__
+#define __TEXTURECACHE_H__
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <unordered_map>
+#include <tinyobjloader/tiny_obj_loader.h>
+#include "tgaimage.h"
+
+class ThreadPool;
+
+// Process-wide cache of decoded textures keyed by normalized path. request()
+// returns at once and decodes on the pool, so textures load while the OBJ is
+// still being parsed; asking again for a path, from another material or mesh,
+// returns a handle to the same image. Entries stay cached until trim() finds
+// no handle left referring to them.
+class TextureCache {
+	struct Entry {
+		TGAImage image;
+		std::shared_future<bool> ready;
+	};
+	ThreadPool &threads;
+	std::mutex mtx;
+	std::unordered_map<std::string, std::shared_ptr<Entry> > entries;
+public:
+	// Refcounted reference to a cached texture, cheap to copy.
+	class Handle {
+		std::shared_ptr<Entry> entry;
+		friend class TextureCache;
+	public:
+		bool valid() const { return entry!=NULL; }
+		// waits for the decode, so not from a pool task; NULL for an empty handle or a file that could not be read
+		TGAImage *get() const;
+	};
+
+	explicit TextureCache(ThreadPool &threads);
+	TextureCache(const TextureCache &) = delete;
+	TextureCache & operator =(const TextureCache &) = delete;
+
+	Handle request(const char *filename);
+	// every map the materials name, relative to base_path, each file decoded once
+	std::vector<Handle> request_materials(const std::vector<tinyobj::material_t> &materials, const char *base_path);
+	size_t size();
+	size_t trim(); // drops textures no handle refers to, returns how many
+
+	static TextureCache &shared(); // on ThreadPool::shared(), created on first use
+};
+
+#endif //__TEXTURECACHE_H__
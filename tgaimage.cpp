@@ -1,48 +1,173 @@
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
 #include <string.h>
 #include <time.h>
 #include <math.h>
 #include "tgaimage.h"
+#include "mappedfile.h"
+#include "tgarle.h"
+#include "threadpool.h"
 
-TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
+ImagePool::~ImagePool() {
+	trim();
 }
 
-TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
-	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+unsigned char *ImagePool::acquire(size_t nbytes, size_t &capacity) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		std::multimap<size_t, unsigned char *>::iterator it = free_buffers.lower_bound(nbytes);
+		// don't hand a huge buffer to a thumbnail
+		if (it!=free_buffers.end() && it->first<=nbytes*2) {
+			unsigned char *buf = it->second;
+			capacity = it->first;
+			free_buffers.erase(it);
+			return buf;
+		}
+	}
+	capacity = nbytes;
+	return new unsigned char[nbytes];
+}
+
+void ImagePool::release(unsigned char *buf, size_t capacity) {
+	if (!buf) return;
+	std::lock_guard<std::mutex> lock(mtx);
+	free_buffers.insert(std::make_pair(capacity, buf));
+}
+
+void ImagePool::trim() {
+	std::lock_guard<std::mutex> lock(mtx);
+	for (std::multimap<size_t, unsigned char *>::iterator it=free_buffers.begin(); it!=free_buffers.end(); ++it)
+		delete [] it->second;
+	free_buffers.clear();
+}
+
+TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0), capacity(0), pool(NULL), owned(true), stride(0), mapping(NULL), origin(TOP_LEFT) {
+}
+
+TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp), capacity(0), pool(NULL), owned(true),
+	stride((ptrdiff_t)w*bpp), mapping(NULL), origin(TOP_LEFT) {
+	size_t nbytes = (size_t)width*height*bytespp;
+	alloc_data(nbytes);
 	memset(data, 0, nbytes);
 }
 
-TGAImage::TGAImage(const TGAImage &img) {
+// wraps caller-owned memory of at least w*h*bpp bytes; the image never frees it
+TGAImage::TGAImage(int w, int h, int bpp, unsigned char *mem) : data(mem), width(w), height(h), bytespp(bpp), capacity((size_t)w*h*bpp), pool(NULL), owned(false),
+	stride((ptrdiff_t)w*bpp), mapping(NULL), origin(TOP_LEFT) {
+}
+
+// takes a (possibly recycled, hence not zeroed) buffer from pool and returns it there on destruction
+TGAImage::TGAImage(int w, int h, int bpp, ImagePool &p) : data(NULL), width(w), height(h), bytespp(bpp), capacity(0), pool(&p), owned(true),
+	stride((ptrdiff_t)w*bpp), mapping(NULL), origin(TOP_LEFT) {
+	alloc_data((size_t)width*height*bytespp);
+}
+
+TGAImage::TGAImage(const TGAImage &img) : data(NULL), capacity(0), pool(NULL), owned(true), mapping(NULL), origin(TOP_LEFT) {
 	width = img.width;
 	height = img.height;
 	bytespp = img.bytespp;
-	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
-	memcpy(data, img.data, nbytes);
+	stride = (ptrdiff_t)width*bytespp;
+	alloc_data((size_t)width*height*bytespp);
+	origin = img.origin;
+	copy_rows(img);
+}
+
+// the copy is always packed, whatever the layout of the source
+void TGAImage::copy_rows(const TGAImage &img) {
+	size_t bytes_per_line = (size_t)width*bytespp;
+	if (img.stride==(ptrdiff_t)bytes_per_line) {
+		memcpy(data, img.data, bytes_per_line*height);
+		return;
+	}
+	for (int j=0; j<height; j++)
+		memcpy(data+j*bytes_per_line, img.data+j*img.stride, bytes_per_line);
+}
+
+TGAImage::TGAImage(TGAImage &&img) noexcept : data(img.data), width(img.width), height(img.height), bytespp(img.bytespp),
+	capacity(img.capacity), pool(img.pool), owned(img.owned), stride(img.stride), mapping(img.mapping), origin(img.origin) {
+	img.data = NULL;
+	img.mapping = NULL;
+	img.stride = 0;
+	img.width = img.height = img.bytespp = 0;
+	img.capacity = 0;
+	img.pool = NULL;
+	img.owned = true;
 }
 
 TGAImage::~TGAImage() {
-	if (data) delete [] data;
+	release_data();
+}
+
+void TGAImage::alloc_data(size_t nbytes) {
+	if (pool) {
+		data = pool->acquire(nbytes, capacity);
+	} else {
+		data = new unsigned char[nbytes];
+		capacity = nbytes;
+	}
+	owned = true;
+}
+
+void TGAImage::release_data() {
+	if (data && owned) {
+		if (pool) pool->release(data, capacity);
+		else delete [] data;
+	}
+	delete mapping;
+	mapping = NULL;
+	data = NULL;
+	capacity = 0;
+	owned = true;
 }
 
 TGAImage & TGAImage::operator =(const TGAImage &img) {
 	if (this != &img) {
-		if (data) delete [] data;
+		size_t nbytes = (size_t)img.width*img.height*img.bytespp;
+		// reuse our buffer when it is big enough (always the case for same-sized frames)
+		if (!data || !owned || mapping || capacity<nbytes) {
+			release_data();
+			alloc_data(nbytes);
+		}
 		width  = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
-		unsigned long nbytes = width*height*bytespp;
-		data = new unsigned char[nbytes];
-		memcpy(data, img.data, nbytes);
+		stride = (ptrdiff_t)width*bytespp;
+		origin = img.origin;
+		copy_rows(img);
 	}
 	return *this;
 }
 
-bool TGAImage::read_tga_file(const char *filename) {
-	if (data) delete [] data;
-	data = NULL;
+TGAImage & TGAImage::operator =(TGAImage &&img) noexcept {
+	if (this != &img) {
+		release_data();
+		data = img.data;
+		width = img.width;
+		height = img.height;
+		bytespp = img.bytespp;
+		capacity = img.capacity;
+		pool = img.pool;
+		owned = img.owned;
+		stride = img.stride;
+		mapping = img.mapping;
+		origin = img.origin;
+		img.data = NULL;
+		img.mapping = NULL;
+		img.stride = 0;
+		img.width = img.height = img.bytespp = 0;
+		img.capacity = 0;
+		img.pool = NULL;
+		img.owned = true;
+	}
+	return *this;
+}
+
+// With threads, RLE data is decoded in parallel chunks (see tga_rle_decode_parallel).
+bool TGAImage::read_tga_file(const char *filename, ThreadPool *threads) {
+	release_data();
+	origin = TOP_LEFT;
 	std::ifstream in;
 	in.open (filename, std::ios::binary);
 	if (!in.is_open()) {
@@ -65,8 +190,9 @@ bool TGAImage::read_tga_file(const char *filename) {
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
-	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
+	size_t nbytes = (size_t)bytespp*width*height;
+	alloc_data(nbytes);
+	stride = (ptrdiff_t)width*bytespp;
 	if (3==header.datatypecode || 2==header.datatypecode) {
 		in.read((char *)data, nbytes);
 		if (!in.good()) {
@@ -75,7 +201,7 @@ bool TGAImage::read_tga_file(const char *filename) {
 			return false;
 		}
 	} else if (10==header.datatypecode||11==header.datatypecode) {
-		if (!load_rle_data(in)) {
+		if (!load_rle_data(in, threads)) {
 			in.close();
 			std::cerr << "an error occured while reading the data\n";
 			return false;
@@ -86,69 +212,137 @@ bool TGAImage::read_tga_file(const char *filename) {
 		return false;
 	}
 	if (!(header.imagedescriptor & 0x20)) {
-		flip_vertically();
+		flip_vertically(threads);
 	}
 	if (header.imagedescriptor & 0x10) {
-		flip_horizontally();
+		flip_horizontally(threads);
 	}
 	std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
 	in.close();
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-	unsigned long pixelcount = width*height;
-	unsigned long currentpixel = 0;
-	unsigned long currentbyte  = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
+// Points the image straight into a private mapping of the file: no read, no copy,
+// and pages only fault in when touched. A bottom-left origin is expressed as a
+// negative stride instead of a flip. RLE files are decoded straight from the
+// mapping; right-to-left files go through read_tga_file().
+bool TGAImage::map_tga_file(const char *filename, ThreadPool *threads) {
+	MappedFile *map = new MappedFile();
+	if (!map->open(filename)) {
+		delete map;
+		return false;
+	}
+	TGA_Header header;
+	if (map->size()<sizeof(header)) {
+		delete map;
+		std::cerr << "an error occured while reading the header\n";
+		return false;
+	}
+	memcpy(&header, map->data(), sizeof(header));
+	bool rle = (10==header.datatypecode || 11==header.datatypecode);
+	if ((!rle && 3!=header.datatypecode && 2!=header.datatypecode) || (header.imagedescriptor & 0x10)) {
+		delete map;
+		return read_tga_file(filename, threads);
+	}
+	int w   = header.width;
+	int h   = header.height;
+	int bpp = header.bitsperpixel>>3;
+	if (w<=0 || h<=0 || (bpp!=GRAYSCALE && bpp!=RGB && bpp!=RGBA)) {
+		delete map;
+		std::cerr << "bad bpp (or width/height) value\n";
+		return false;
+	}
+	size_t offset = sizeof(header)+(unsigned char)header.idlength;
+	if (header.colormaptype)
+		offset += (size_t)(unsigned short)header.colormaplength*(((unsigned char)header.colormapdepth+7)>>3);
+	size_t bytes_per_line = (size_t)w*bpp;
+	if (rle) {
+		// has to be decoded anyway, but straight out of the mapping
+		release_data();
+		origin  = TOP_LEFT;
+		width   = w;
+		height  = h;
+		bytespp = bpp;
+		stride  = (ptrdiff_t)bytes_per_line;
+		alloc_data(bytes_per_line*h);
+		bool ok = offset<map->size() && decode_rle(map->data()+offset, map->size()-offset, threads);
+		delete map;
+		if (!ok) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
-		if (chunkheader<128) {
-			chunkheader++;
-			for (int i=0; i<chunkheader; i++) {
-				in.read((char *)colorbuffer.raw, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		} else {
-			chunkheader -= 127;
-			in.read((char *)colorbuffer.raw, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
-				return false;
-			}
-			for (int i=0; i<chunkheader; i++) {
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
+		if (!(header.imagedescriptor & 0x20)) {
+			flip_vertically(threads);
 		}
-	} while (currentpixel < pixelcount);
+		std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
+		return true;
+	}
+	if (offset+bytes_per_line*h>map->size()) {
+		delete map;
+		std::cerr << "an error occured while reading the data\n";
+		return false;
+	}
+	release_data();
+	origin  = TOP_LEFT;
+	width   = w;
+	height  = h;
+	bytespp = bpp;
+	owned   = false;
+	mapping = map;
+	capacity = bytes_per_line*h;
+	if (header.imagedescriptor & 0x20) {
+		data   = map->data()+offset;
+		stride = (ptrdiff_t)bytes_per_line;
+	} else {
+		data   = map->data()+offset+bytes_per_line*(h-1);
+		stride = -(ptrdiff_t)bytes_per_line;
+	}
+	std::cerr << width << "x" << height << "/" << bytespp*8 << " (mapped)\n";
 	return true;
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle) {
+// Slurps the rest of the file with a single read and decodes it from memory,
+// instead of one stream call per packet and per raw pixel.
+bool TGAImage::load_rle_data(std::ifstream &in, ThreadPool *threads) {
+	std::streampos start = in.tellg();
+	in.seekg(0, std::ios::end);
+	std::streamoff len = in.tellg()-start;
+	in.seekg(start);
+	if (len<=0) {
+		std::cerr << "an error occured while reading the data\n";
+		return false;
+	}
+	std::vector<unsigned char> payload((size_t)len);
+	in.read((char *)payload.data(), len);
+	if (!in.good()) {
+		std::cerr << "an error occured while reading the data\n";
+		return false;
+	}
+	return decode_rle(payload.data(), payload.size(), threads);
+}
+
+bool TGAImage::decode_rle(const unsigned char *src, size_t len, ThreadPool *threads) {
+	size_t npixels = (size_t)width*height;
+	if (threads && threads->size()>1)
+		return 0!=tga_rle_decode_parallel(src, len, data, npixels, bytespp, *threads);
+	return 0!=tga_rle_decode(src, len, data, npixels, bytespp);
+}
+
+// With threads, RLE packets are cut at stripe (scanline) boundaries and the stripes
+// are encoded in parallel, then written in order.
+bool TGAImage::write_tga_file(const char *filename, bool rle, ThreadPool *threads) {
+	if (data && !is_packed()) {
+		// e.g. a mapped file with bottom-up rows; the writers below want contiguous rows
+		TGAImage packed(*this);
+		return packed.write_tga_file(filename, rle, threads);
+	}
 	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
 	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
 	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+	if (width>65535 || height>65535) {
+		std::cerr << "a tga file can't hold " << width << "x" << height << " pixels\n";
+		return false;
+	}
 	std::ofstream out;
 	out.open (filename, std::ios::binary);
 	if (!out.is_open()) {
@@ -162,7 +356,7 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	header.width  = width;
 	header.height = height;
 	header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
-	header.imagedescriptor = 0x20; // top-left origin
+	header.imagedescriptor = (TOP_LEFT==origin ? 0x20 : 0x00); // rows go out in memory order, the descriptor says where row 0 belongs
 	out.write((char *)&header, sizeof(header));
 	if (!out.good()) {
 		out.close();
@@ -170,14 +364,14 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 		return false;
 	}
 	if (!rle) {
-		out.write((char *)data, width*height*bytespp);
+		out.write((char *)data, (std::streamsize)((size_t)width*height*bytespp));
 		if (!out.good()) {
 			std::cerr << "can't unload raw data\n";
 			out.close();
 			return false;
 		}
 	} else {
-		if (!unload_rle_data(out)) {
+		if (!unload_rle_data(out, threads)) {
 			out.close();
 			std::cerr << "can't unload rle data\n";
 			return false;
@@ -205,46 +399,40 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 	return true;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width*height;
-	unsigned long curpix = 0;
-	while (curpix<npixels) {
-		unsigned long chunkstart = curpix*bytespp;
-		unsigned long curbyte = curpix*bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix+run_length<npixels && run_length<max_chunk_length) {
-			bool succ_eq = true;
-			for (int t=0; succ_eq && t<bytespp; t++) {
-				succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
-			}
-			curbyte += bytespp;
-			if (1==run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
+// Encodes the whole image into one pre-sized buffer and hands it to the stream with a single write.
+// With threads the image is cut into horizontal stripes, each encoded on its own into its own buffer;
+// packets never cross a stripe boundary, so the concatenation is a valid stream.
+bool TGAImage::unload_rle_data(std::ofstream &out, ThreadPool *threads) {
+	size_t npixels = (size_t)width*height;
+	if (!threads || threads->size()<2 || height<2) {
+		std::vector<unsigned char> packets(tga_rle_bound(npixels, bytespp));
+		size_t len = tga_rle_encode(data, npixels, bytespp, packets.data());
+		if (!len) return false;
+		out.write((char *)packets.data(), len);
+	} else {
+		int rows = height/(int)(threads->size()*4);
+		if (rows<16) rows = 16;
+		int nstripes = (height+rows-1)/rows;
+		std::vector<std::vector<unsigned char> > stripes(nstripes);
+		std::vector<size_t> lengths(nstripes, 0);
+		threads->parallel_for(nstripes, 1, [&](size_t begin, size_t end) {
+			for (size_t i=begin; i<end; i++) {
+				int y0 = (int)i*rows;
+				int y1 = y0+rows<height ? y0+rows : height;
+				size_t n = (size_t)(y1-y0)*width;
+				stripes[i].resize(tga_rle_bound(n, bytespp));
+				lengths[i] = tga_rle_encode(row(y0), n, bytespp, stripes[i].data());
 			}
-			run_length++;
-		}
-		curpix += run_length;
-		out.put(raw?run_length-1:run_length+127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
-		out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+		});
+		for (int i=0; i<nstripes; i++) {
+			if (!lengths[i]) return false;
+			out.write((char *)stripes[i].data(), lengths[i]);
 		}
 	}
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
 	return true;
 }
 
@@ -252,14 +440,68 @@ TGAColor TGAImage::get(int x, int y) {
 	if (!data || x<0 || y<0 || x>=width || y>=height) {
 		return TGAColor();
 	}
-	return TGAColor(data+(x+y*width)*bytespp, bytespp);
+	return TGAColor(row(y)+x*bytespp, bytespp);
 }
 
 bool TGAImage::set(int x, int y, TGAColor c) {
 	if (!data || x<0 || y<0 || x>=width || y>=height) {
 		return false;
 	}
-	memcpy(data+(x+y*width)*bytespp, c.raw, bytespp);
+	memcpy(row(y)+x*bytespp, c.raw, bytespp);
+	return true;
+}
+
+// Replicates the pixel at dst[0..bpp) over n pixels by doubling memcpy's, so the
+// bulk of the fill goes through the (vectorized) library copy whatever the bpp.
+static void fill_pixels(unsigned char *dst, const unsigned char *px, int bpp, size_t n) {
+	if (!n) return;
+	if (1==bpp) {
+		memset(dst, px[0], n);
+		return;
+	}
+	size_t total = n*bpp;
+	size_t done  = bpp;
+	memcpy(dst, px, bpp);
+	while (done<total) {
+		size_t chunk = done<total-done ? done : total-done;
+		memcpy(dst+done, dst, chunk);
+		done += chunk;
+	}
+}
+
+// Clips [x, x+len) on row y once; returns false if nothing is left to write.
+static bool clip_span(int &x, int y, int &len, int width, int height, int *skip=NULL) {
+	if (y<0 || y>=height || len<=0) return false;
+	int s = x<0 ? -x : 0;
+	x += s;
+	len -= s;
+	if (x+len>width) len = width-x;
+	if (skip) *skip = s;
+	return len>0;
+}
+
+bool TGAImage::set_span(int x, int y, int len, TGAColor c) {
+	if (!data || !clip_span(x, y, len, width, height)) return false;
+	fill_pixels(row(y)+x*bytespp, c.raw, bytespp, len);
+	return true;
+}
+
+// src holds len pixels in this image's format, src[0] landing on (x, y)
+bool TGAImage::copy_span(int x, int y, int len, const unsigned char *src) {
+	int skip = 0;
+	if (!data || !clip_span(x, y, len, width, height, &skip)) return false;
+	memcpy(row(y)+x*bytespp, src+(size_t)skip*bytespp, (size_t)len*bytespp);
+	return true;
+}
+
+bool TGAImage::fill_rect(int x, int y, int w, int h, TGAColor c) {
+	int y0 = y<0 ? 0 : y;
+	int y1 = y+h>height ? height : y+h;
+	if (!data || y0>=y1 || !clip_span(x, y0, w, width, height)) return false;
+	unsigned char *first = row(y0)+x*bytespp;
+	fill_pixels(first, c.raw, bytespp, w);
+	for (int j=y0+1; j<y1; j++)
+		memcpy(row(j)+x*bytespp, first, (size_t)w*bytespp);
 	return true;
 }
 
@@ -275,33 +517,164 @@ int TGAImage::get_height() {
 	return height;
 }
 
-bool TGAImage::flip_horizontally() {
-	if (!data) return false;
-	int half = width>>1;
-	for (int i=0; i<half; i++) {
-		for (int j=0; j<height; j++) {
-			TGAColor c1 = get(i, j);
-			TGAColor c2 = get(width-1-i, j);
-			set(i, j, c2);
-			set(width-1-i, j, c1);
+// Below this many bytes an image transform isn't worth waking the pool for.
+static const size_t parallel_min_bytes = 4<<20;
+
+// Runs f(y0, y1) over all rows, in bands on threads when the image is large enough.
+template <class F> static void for_rows(ThreadPool *threads, int height, size_t bytes, F f) {
+	if (!threads || threads->size()<2 || bytes<parallel_min_bytes) {
+		f(0, height);
+		return;
+	}
+	size_t band = height/(threads->size()*4)+1;
+	threads->parallel_for(height, band, [&](size_t y0, size_t y1) { f((int)y0, (int)y1); });
+}
+
+#ifdef TGA_SSE2
+// 4 RGB pixels (12 bytes, the low ones of x) spread to one per dword: pixel i moves up i bytes
+static inline __m128i spread_rgb(__m128i x) {
+	const __m128i m0 = _mm_setr_epi32(0xFFFFFF, 0, 0, 0), m1 = _mm_setr_epi32(0, 0xFFFFFF, 0, 0);
+	const __m128i m2 = _mm_setr_epi32(0, 0, 0xFFFFFF, 0), m3 = _mm_setr_epi32(0, 0, 0, 0xFFFFFF);
+	return _mm_or_si128(_mm_or_si128(_mm_and_si128(x, m0), _mm_and_si128(_mm_slli_si128(x, 1), m1)),
+		_mm_or_si128(_mm_and_si128(_mm_slli_si128(x, 2), m2), _mm_and_si128(_mm_slli_si128(x, 3), m3)));
+}
+
+// the inverse: one pixel per dword back to 12 packed bytes
+static inline __m128i pack_rgb(__m128i x) {
+	const __m128i n0 = _mm_setr_epi8(-1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i n1 = _mm_setr_epi8(0, 0, 0, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i n2 = _mm_setr_epi8(0, 0, 0, 0, 0, 0, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i n3 = _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 0, -1, -1, -1, 0, 0, 0, 0);
+	return _mm_or_si128(_mm_or_si128(_mm_and_si128(x, n0), _mm_and_si128(_mm_srli_si128(x, 1), n1)),
+		_mm_or_si128(_mm_and_si128(_mm_srli_si128(x, 2), n2), _mm_and_si128(_mm_srli_si128(x, 3), n3)));
+}
+
+// 4 RGB pixels in reverse order
+static inline __m128i reverse_rgb4(__m128i x) {
+	return pack_rgb(_mm_shuffle_epi32(spread_rgb(x), _MM_SHUFFLE(0, 1, 2, 3)));
+}
+
+static inline void store_rgb4(unsigned char *p, __m128i x) {
+	_mm_storel_epi64((__m128i *)p, x);
+	int tail = _mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+	memcpy(p+8, &tail, 4);
+}
+#endif
+
+// Reverses the order of the pixels of one row in place. Walks inwards from both ends
+// so each row is streamed once; 1 and 4 byte pixels swap whole 16 byte blocks, 3 byte
+// pixels 12 byte groups of four.
+template <int BPP> static void reverse_row(unsigned char *p, int width) {
+	unsigned char *lo = p;
+	unsigned char *hi = p+(size_t)(width-1)*BPP;
+#ifdef TGA_SSE2
+	if (4==BPP) {
+		for (; hi-lo>=7*4; lo+=16, hi-=16) {
+			__m128i a = _mm_loadu_si128((const __m128i *)lo);
+			__m128i b = _mm_loadu_si128((const __m128i *)(hi-12));
+			_mm_storeu_si128((__m128i *)lo,        _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3)));
+			_mm_storeu_si128((__m128i *)(hi-12),   _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 1, 2, 3)));
+		}
+	} else if (1==BPP) {
+		for (; hi-lo>=31; lo+=16, hi-=16) {
+			__m128i a = _mm_loadu_si128((const __m128i *)lo);
+			__m128i b = _mm_loadu_si128((const __m128i *)(hi-15));
+			// dwords, then words within dwords, then bytes within words
+			a = _mm_shuffle_epi32(a, _MM_SHUFFLE(0, 1, 2, 3));
+			b = _mm_shuffle_epi32(b, _MM_SHUFFLE(0, 1, 2, 3));
+			a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+			b = _mm_shufflehi_epi16(_mm_shufflelo_epi16(b, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+			a = _mm_or_si128(_mm_slli_epi16(a, 8), _mm_srli_epi16(a, 8));
+			b = _mm_or_si128(_mm_slli_epi16(b, 8), _mm_srli_epi16(b, 8));
+			_mm_storeu_si128((__m128i *)lo,        b);
+			_mm_storeu_si128((__m128i *)(hi-15),   a);
 		}
+	} else if (3==BPP) {
+		// the groups are lo..lo+11 and hi-9..hi+2; both 16 byte loads stay inside the row
+		for (; hi-lo>=7*3; lo+=12, hi-=12) {
+			__m128i a = _mm_loadu_si128((const __m128i *)lo);
+			__m128i b = _mm_srli_si128(_mm_loadu_si128((const __m128i *)(hi-13)), 4);
+			store_rgb4(lo,     reverse_rgb4(b));
+			store_rgb4(hi-9,   reverse_rgb4(a));
+		}
+	}
+#endif
+	for (; lo<hi; lo+=BPP, hi-=BPP) {
+		unsigned char t[BPP];
+		memcpy(t, lo, BPP);
+		memcpy(lo, hi, BPP);
+		memcpy(hi, t, BPP);
 	}
+}
+
+bool TGAImage::flip_horizontally(ThreadPool *threads) {
+	if (!data) return false;
+	for_rows(threads, height, (size_t)width*height*bytespp, [&](int y0, int y1) {
+		for (int j=y0; j<y1; j++) {
+			switch (bytespp) {
+				case GRAYSCALE: reverse_row<1>(row(j), width); break;
+				case RGB:       reverse_row<3>(row(j), width); break;
+				case RGBA:      reverse_row<4>(row(j), width); break;
+			}
+		}
+	});
 	return true;
 }
 
-bool TGAImage::flip_vertically() {
+bool TGAImage::flip_vertically(ThreadPool *threads) {
 	if (!data) return false;
-	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
-	int half = height>>1;
-	for (int j=0; j<half; j++) {
-		unsigned long l1 = j*bytes_per_line;
-		unsigned long l2 = (height-1-j)*bytes_per_line;
-		memmove((void *)line,      (void *)(data+l1), bytes_per_line);
-		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
-		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
-	}
-	delete [] line;
+	size_t bytes_per_line = (size_t)width*bytespp;
+	// swap_ranges swaps in registers, no temporary line to allocate
+	for_rows(threads, height>>1, bytes_per_line*height, [&](int j0, int j1) {
+		for (int j=j0; j<j1; j++)
+			std::swap_ranges(row(j), row(j)+bytes_per_line, row(height-1-j));
+	});
+	return true;
+}
+
+template <class Src, class Dst> static void convert_row(const unsigned char *src, unsigned char *dst, int width) {
+	for (int i=0; i<width; i++, src+=Src::bytespp, dst+=Dst::bytespp) {
+		Pixel32 c = Src::load(src);
+		if (Src::bytespp==1) c = Pixel32(c.b, c.b, c.b, 255);
+		else if (Src::bytespp==3) c.a = 255;
+		if (Dst::bytespp==1) c.b = (unsigned char)((c.r*77+c.g*150+c.b*29)>>8); // Rec. 601 luma
+		Dst::store(dst, c);
+	}
+}
+
+template <class Src, class Dst> static void convert_rows(TGAImage &img, unsigned char *tdata, int y0, int y1) {
+	int width = img.get_width();
+	for (int j=y0; j<y1; j++)
+		convert_row<Src, Dst>(img.row(j), tdata+(size_t)j*width*Dst::bytespp, width);
+}
+
+template <class Src> static void convert_rows(TGAImage &img, unsigned char *tdata, int bpp, int y0, int y1) {
+	switch (bpp) {
+		case TGAImage::GRAYSCALE: convert_rows<Src, Gray8>(img, tdata, y0, y1); break;
+		case TGAImage::RGB:       convert_rows<Src, RGB8> (img, tdata, y0, y1); break;
+		case TGAImage::RGBA:      convert_rows<Src, RGBA8>(img, tdata, y0, y1); break;
+	}
+}
+
+// Changes the pixel format: gray expands to equal channels, color to gray goes through
+// luma, and alpha comes out opaque when the source has none.
+bool TGAImage::convert(int bpp, ThreadPool *threads) {
+	if (!data || (bpp!=GRAYSCALE && bpp!=RGB && bpp!=RGBA)) return false;
+	if (bpp==bytespp) return true;
+	size_t tcapacity = (size_t)width*height*bpp;
+	unsigned char *tdata = pool ? pool->acquire(tcapacity, tcapacity) : new unsigned char[tcapacity];
+	for_rows(threads, height, tcapacity, [&](int y0, int y1) {
+		switch (bytespp) {
+			case GRAYSCALE: convert_rows<Gray8>(*this, tdata, bpp, y0, y1); break;
+			case RGB:       convert_rows<RGB8> (*this, tdata, bpp, y0, y1); break;
+			case RGBA:      convert_rows<RGBA8>(*this, tdata, bpp, y0, y1); break;
+		}
+	});
+	release_data();
+	data = tdata;
+	capacity = tcapacity;
+	bytespp = bpp;
+	stride = (ptrdiff_t)width*bpp;
 	return true;
 }
 
@@ -309,19 +682,32 @@ unsigned char *TGAImage::buffer() {
 	return data;
 }
 
-void TGAImage::clear() {
-	memset((void *)data, 0, width*height*bytespp);
+void TGAImage::clear(ThreadPool *threads) {
+	if (!data) return;
+	size_t bytes_per_line = (size_t)width*bytespp;
+	if (is_packed() && (!threads || bytes_per_line*height<parallel_min_bytes)) {
+		memset((void *)data, 0, bytes_per_line*height);
+		return;
+	}
+	for_rows(threads, height, bytes_per_line*height, [&](int y0, int y1) {
+		if (is_packed()) {
+			memset((void *)row(y0), 0, bytes_per_line*(y1-y0));
+			return;
+		}
+		for (int j=y0; j<y1; j++)
+			memset((void *)row(j), 0, bytes_per_line);
+	});
 }
 
 bool TGAImage::scale(int w, int h) {
 	if (w<=0 || h<=0 || !data) return false;
-	unsigned char *tdata = new unsigned char[w*h*bytespp];
-	int nscanline = 0;
-	int oscanline = 0;
+	size_t tcapacity = (size_t)w*h*bytespp;
+	unsigned char *tdata = pool ? pool->acquire(tcapacity, tcapacity) : new unsigned char[tcapacity];
+	size_t nscanline = 0;
 	int erry = 0;
-	unsigned long nlinebytes = w*bytespp;
-	unsigned long olinebytes = width*bytespp;
+	size_t nlinebytes = (size_t)w*bytespp;
 	for (int j=0; j<height; j++) {
+		unsigned char *oline = row(j);
 		int errx = width-w;
 		int nx   = -bytespp;
 		int ox   = -bytespp;
@@ -331,11 +717,10 @@ bool TGAImage::scale(int w, int h) {
 			while (errx>=(int)width) {
 				errx -= width;
 				nx += bytespp;
-				memcpy(tdata+nscanline+nx, data+oscanline+ox, bytespp);
+				memcpy(tdata+nscanline+nx, oline+ox, bytespp);
 			}
 		}
 		erry += h;
-		oscanline += olinebytes;
 		while (erry>=(int)height) {
 			if (erry>=(int)height<<1) // it means we jump over a scanline
 				memcpy(tdata+nscanline+nlinebytes, tdata+nscanline, nlinebytes);
@@ -343,8 +728,10 @@ bool TGAImage::scale(int w, int h) {
 			nscanline += nlinebytes;
 		}
 	}
-	delete [] data;
+	release_data();
 	data = tdata;
+	capacity = tcapacity;
+	stride = (ptrdiff_t)nlinebytes;
 	width = w;
 	height = h;
 	return true;
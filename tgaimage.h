@@ -2,6 +2,13 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <assert.h>
+#include "pixel.h"
+
+class MappedFile;
+class ThreadPool;
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -13,8 +20,8 @@ struct TGA_Header {
 	char colormapdepth;
 	short x_origin;
 	short y_origin;
-	short width;
-	short height;
+	unsigned short width; // TGA caps both at 65535
+	unsigned short height;
 	char  bitsperpixel;
 	char  imagedescriptor;
 };
@@ -50,6 +57,13 @@ struct TGAColor {
 		}
 	}
 
+	TGAColor(Pixel32 p, int bpp) : val(p.bits()), bytespp(bpp) {
+	}
+
+	Pixel32 pixel() const {
+		return Pixel32::from_bits(val);
+	}
+
 	TGAColor & operator =(const TGAColor &c) {
 		if (this != &c) {
 			bytespp = c.bytespp;
@@ -60,37 +74,99 @@ struct TGAColor {
 };
 
 
+// Recycles image buffers so frames and temporaries don't hit new[]/delete[] every time.
+// acquire() hands out the smallest free buffer that fits; thread safe.
+class ImagePool {
+	std::multimap<size_t, unsigned char *> free_buffers;
+	std::mutex mtx;
+public:
+	ImagePool() {}
+	ImagePool(const ImagePool &) = delete;
+	ImagePool & operator =(const ImagePool &) = delete;
+	~ImagePool();
+	unsigned char *acquire(size_t nbytes, size_t &capacity);
+	void release(unsigned char *buf, size_t capacity);
+	void trim();
+};
+
 class TGAImage {
 protected:
 	unsigned char* data;
 	int width;
 	int height;
 	int bytespp;
-
-	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
+	size_t capacity; // bytes behind data, may exceed width*height*bytespp for pooled buffers
+	ImagePool *pool; // where data goes back to, NULL for new[] or caller-owned memory
+	bool owned;      // false when data belongs to the caller or to mapping
+	ptrdiff_t stride; // bytes from one row to the next, negative for bottom-up rows in a mapped file
+	MappedFile *mapping; // file data points into, NULL for in-memory images
+	int origin; // corner row 0 is displayed at, only used when writing files
+
+	void alloc_data(size_t nbytes);
+	void release_data();
+	void copy_rows(const TGAImage &img);
+
+	bool   load_rle_data(std::ifstream &in, ThreadPool *threads);
+	bool unload_rle_data(std::ofstream &out, ThreadPool *threads);
+	bool decode_rle(const unsigned char *src, size_t len, ThreadPool *threads);
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
 	};
 
+	enum Origin {
+		TOP_LEFT, BOTTOM_LEFT
+	};
+
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
+	TGAImage(int w, int h, int bpp, unsigned char *mem);
+	TGAImage(int w, int h, int bpp, ImagePool &pool);
 	TGAImage(const TGAImage &img);
-	bool read_tga_file(const char *filename);
-	bool write_tga_file(const char *filename, bool rle=true);
-	bool flip_horizontally();
-	bool flip_vertically();
+	TGAImage(TGAImage &&img) noexcept;
+	bool read_tga_file(const char *filename, ThreadPool *threads=NULL);
+	bool map_tga_file(const char *filename, ThreadPool *threads=NULL);
+	bool write_tga_file(const char *filename, bool rle=true, ThreadPool *threads=NULL);
+	// with threads, images above a few MB are processed in row bands on the pool
+	bool flip_horizontally(ThreadPool *threads=NULL);
+	bool flip_vertically(ThreadPool *threads=NULL);
+	bool convert(int bpp, ThreadPool *threads=NULL);
 	bool scale(int w, int h);
 	TGAColor get(int x, int y);
 	bool set(int x, int y, TGAColor c);
+	unsigned char *row(int y) { return data+y*stride; } // unchecked
+	bool set_span(int x, int y, int len, TGAColor c);
+	bool copy_span(int x, int y, int len, const unsigned char *src);
+	bool fill_rect(int x, int y, int w, int h, TGAColor c);
 	~TGAImage();
 	TGAImage & operator =(const TGAImage &img);
+	TGAImage & operator =(TGAImage &&img) noexcept;
 	int get_width();
 	int get_height();
 	int get_bytespp();
-	unsigned char *buffer();
-	void clear();
+	ptrdiff_t get_stride() { return stride; }
+	// Files are read as TOP_LEFT. Rendering y-up into a BOTTOM_LEFT image gets written with
+	// the matching TGA descriptor bit, no flip_vertically() needed.
+	void set_origin(Origin o) { origin = o; }
+	Origin get_origin() { return (Origin)origin; }
+	bool is_packed() { return stride==(ptrdiff_t)width*bytespp; }
+	unsigned char *buffer(); // row 0; the rows are only contiguous when is_packed()
+	void clear(ThreadPool *threads=NULL);
+
+	template <class Fmt> ImageView<Fmt> view() {
+		assert(Fmt::bytespp==bytespp);
+		return ImageView<Fmt>(data, width, height, stride);
+	}
+
+	// calls f with the view matching this image's format; dispatches once, not per pixel
+	template <class F> bool visit(F &&f) {
+		switch (bytespp) {
+			case GRAYSCALE: f(view<Gray8>()); return true;
+			case RGB:       f(view<RGB8>());  return true;
+			case RGBA:      f(view<RGBA8>()); return true;
+		}
+		return false;
+	}
 };
 
 #endif //__IMAGE_H__
@@ -0,0 +1,202 @@
+#include <iostream>
+#include <string.h>
+#include "tgarle.h"
+#include "threadpool.h"
+#include "pixel.h"
+
+// Repeats one pixel count times. The pixel is first spread over a 48 byte pattern
+// (a multiple of 1, 3 and 4 bytes) which is then stored in fixed 16 byte blocks,
+// which the compiler turns into plain vector stores.
+static void fill_run(unsigned char *dst, const unsigned char *px, int bytespp, size_t count) {
+	size_t nbytes = count*bytespp;
+	if (1==bytespp) {
+		memset(dst, px[0], nbytes);
+		return;
+	}
+	unsigned char pattern[48];
+	for (int i=0; i<48; i+=bytespp)
+		memcpy(pattern+i, px, bytespp);
+	size_t done = 0;
+	while (done+48<=nbytes) {
+		memcpy(dst+done,    pattern,    16);
+		memcpy(dst+done+16, pattern+16, 16);
+		memcpy(dst+done+32, pattern+32, 16);
+		done += 48;
+	}
+	memcpy(dst+done, pattern, nbytes-done);
+}
+
+size_t tga_rle_decode(const unsigned char *src, size_t srclen, unsigned char *dst, size_t npixels, int bytespp) {
+	const unsigned char *in  = src;
+	const unsigned char *end = src+srclen;
+	size_t curpix = 0;
+	while (curpix<npixels) {
+		if (in>=end) {
+			std::cerr << "an error occured while reading the data\n";
+			return 0;
+		}
+		unsigned char chunkheader = *in++;
+		size_t count = (chunkheader&0x7f)+1;
+		if (count>npixels-curpix) {
+			std::cerr << "Too many pixels read\n";
+			return 0;
+		}
+		size_t payload = chunkheader<128 ? count*bytespp : bytespp;
+		if ((size_t)(end-in)<payload) {
+			std::cerr << "an error occured while reading the data\n";
+			return 0;
+		}
+		if (chunkheader<128) {
+			memcpy(dst, in, payload);
+		} else {
+			fill_run(dst, in, bytespp, count);
+		}
+		in     += payload;
+		dst    += count*bytespp;
+		curpix += count;
+	}
+	return in-src;
+}
+
+size_t tga_rle_scan(const unsigned char *src, size_t srclen, size_t npixels, int bytespp, size_t chunk_pixels, std::vector<TGARleSplit> &splits) {
+	const unsigned char *in  = src;
+	const unsigned char *end = src+srclen;
+	size_t curpix = 0;
+	size_t next_split = chunk_pixels;
+	splits.clear();
+	TGARleSplit first = {0, 0};
+	splits.push_back(first);
+	while (curpix<npixels) {
+		if (curpix>=next_split) {
+			TGARleSplit split = {(size_t)(in-src), curpix};
+			splits.push_back(split);
+			next_split = (curpix/chunk_pixels+1)*chunk_pixels;
+		}
+		if (in>=end) {
+			std::cerr << "an error occured while reading the data\n";
+			return 0;
+		}
+		unsigned char chunkheader = *in++;
+		size_t count = (chunkheader&0x7f)+1;
+		if (count>npixels-curpix) {
+			std::cerr << "Too many pixels read\n";
+			return 0;
+		}
+		size_t payload = chunkheader<128 ? count*bytespp : bytespp;
+		if ((size_t)(end-in)<payload) {
+			std::cerr << "an error occured while reading the data\n";
+			return 0;
+		}
+		in     += payload;
+		curpix += count;
+	}
+	TGARleSplit last = {(size_t)(in-src), npixels};
+	splits.push_back(last);
+	return in-src;
+}
+
+size_t tga_rle_decode_parallel(const unsigned char *src, size_t srclen, unsigned char *dst, size_t npixels, int bytespp, ThreadPool &threads) {
+	// a few chunks per thread to even out packets of very different density
+	size_t chunk_pixels = npixels/(threads.size()*4+1)+1;
+	if (chunk_pixels<65536) chunk_pixels = 65536;
+	std::vector<TGARleSplit> splits;
+	size_t consumed = tga_rle_scan(src, srclen, npixels, bytespp, chunk_pixels, splits);
+	if (!consumed) return 0;
+	std::atomic<bool> ok(true);
+	threads.parallel_for(splits.size()-1, 1, [&](size_t begin, size_t end) {
+		for (size_t i=begin; i<end; i++) {
+			const TGARleSplit &a = splits[i];
+			const TGARleSplit &b = splits[i+1];
+			if (!tga_rle_decode(src+a.src_offset, b.src_offset-a.src_offset, dst+a.pixel*bytespp, b.pixel-a.pixel, bytespp))
+				ok = false;
+		}
+	});
+	return ok ? consumed : 0;
+}
+
+size_t tga_rle_bound(size_t npixels, int bytespp) {
+	// raw bytes plus a header per 128 pixels; shorter packets always pay for their own header
+	return npixels*bytespp+npixels/128+2;
+}
+
+template <int BPP> static inline bool same_pixel(const unsigned char *a, const unsigned char *b) {
+	return 0==memcmp(a, b, BPP); // fixed size, compiles to a single integer compare or two
+}
+
+// Number of pixels (at least 1, at most maxn) equal to the first one. Whole 48 byte
+// blocks (48/BPP pixels) are checked at once against the pixel spread over a pattern.
+template <int BPP> static size_t run_length(const unsigned char *p, size_t maxn) {
+	size_t n = 1;
+	unsigned char pattern[48];
+	for (int i=0; i<48; i+=BPP)
+		memcpy(pattern+i, p, BPP);
+#ifdef TGA_SSE2
+	const __m128i p0 = _mm_loadu_si128((const __m128i *)pattern);
+	const __m128i p1 = _mm_loadu_si128((const __m128i *)(pattern+16));
+	const __m128i p2 = _mm_loadu_si128((const __m128i *)(pattern+32));
+	while (n+48/BPP<=maxn) {
+		const unsigned char *q = p+n*BPP;
+		__m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)q),      p0);
+		__m128i e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(q+16)), p1);
+		__m128i e2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(q+32)), p2);
+		if (0xffff!=_mm_movemask_epi8(_mm_and_si128(_mm_and_si128(e0, e1), e2)))
+			break;
+		n += 48/BPP;
+	}
+#else
+	while (n+48/BPP<=maxn && 0==memcmp(p+n*BPP, pattern, 48))
+		n += 48/BPP;
+#endif
+	while (n<maxn && same_pixel<BPP>(p+n*BPP, p))
+		n++;
+	return n;
+}
+
+template <int BPP> static size_t rle_encode(const unsigned char *src, size_t npixels, unsigned char *dst) {
+	const size_t max_chunk_length = 128;
+	// Shortest run worth breaking a raw chunk for. Two equal pixels cost 2*BPP inside a raw
+	// chunk, or 1+BPP as a run plus 1 for the raw header after it: only a win from 3 bytes
+	// per pixel up. For grayscale it takes three.
+	const size_t min_run = BPP>2 ? 2 : 3;
+	unsigned char *out = dst;
+	size_t i = 0;
+	while (i<npixels) {
+		size_t left = npixels-i < max_chunk_length ? npixels-i : max_chunk_length;
+		size_t run = run_length<BPP>(src+i*BPP, left);
+		if (run>=min_run) {
+			*out++ = (unsigned char)(run+127);
+			memcpy(out, src+i*BPP, BPP);
+			out += BPP;
+			i += run;
+			continue;
+		}
+		size_t start = i;
+		while (i-start<left) {
+			if (i+min_run<=npixels && same_pixel<BPP>(src+i*BPP, src+(i+1)*BPP) && (2==min_run || same_pixel<BPP>(src+i*BPP, src+(i+2)*BPP)))
+				break;
+			i++;
+		}
+		size_t len = i-start;
+		if (2==len && same_pixel<BPP>(src+start*BPP, src+(start+1)*BPP)) {
+			// a lone pair between runs (or at the end) is cheaper as a run
+			*out++ = 128+1;
+			memcpy(out, src+start*BPP, BPP);
+			out += BPP;
+			continue;
+		}
+		*out++ = (unsigned char)(len-1);
+		memcpy(out, src+start*BPP, len*BPP);
+		out += len*BPP;
+	}
+	return out-dst;
+}
+
+size_t tga_rle_encode(const unsigned char *src, size_t npixels, int bytespp, unsigned char *dst) {
+	switch (bytespp) {
+		case 1: return rle_encode<1>(src, npixels, dst);
+		case 3: return rle_encode<3>(src, npixels, dst);
+		case 4: return rle_encode<4>(src, npixels, dst);
+	}
+	std::cerr << "can't encode " << bytespp << " bytes per pixel\n";
+	return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef __TGARLE_H__
+#define __TGARLE_H__
+
+#include <stddef.h>
+#include <vector>
+
+class ThreadPool;
+
+// TGA run-length packets over plain memory buffers, no streams involved.
+
+// Decodes npixels pixels of bytespp bytes from the packets in src[0, srclen) into dst.
+// Every packet is bounds checked against both buffers; returns the number of source
+// bytes consumed, or 0 when the data is truncated or overruns npixels.
+size_t tga_rle_decode(const unsigned char *src, size_t srclen, unsigned char *dst, size_t npixels, int bytespp);
+
+// A packet boundary: packets from src_offset on decode to pixels from pixel on.
+struct TGARleSplit {
+	size_t src_offset;
+	size_t pixel;
+};
+
+// Walks the packet headers only, hopping over their payloads, and records the first packet
+// boundary at or after every multiple of chunk_pixels (plus the start and the end). Same
+// checks and return value as tga_rle_decode.
+size_t tga_rle_scan(const unsigned char *src, size_t srclen, size_t npixels, int bytespp, size_t chunk_pixels, std::vector<TGARleSplit> &splits);
+
+// tga_rle_decode, with the chunks between scanned split points decoded in parallel.
+// The output is byte for byte the serial decoder's.
+size_t tga_rle_decode_parallel(const unsigned char *src, size_t srclen, unsigned char *dst, size_t npixels, int bytespp, ThreadPool &threads);
+
+// Worst case size of tga_rle_encode's output, for pre-sizing the destination.
+size_t tga_rle_bound(size_t npixels, int bytespp);
+
+// Encodes npixels pixels from src into dst, which must hold tga_rle_bound() bytes.
+// Packets never span more than npixels, so calling it once per scanline gives
+// scanline-limited packets. Returns the number of bytes written.
+size_t tga_rle_encode(const unsigned char *src, size_t npixels, int bytespp, unsigned char *dst);
+
+#endif //__TGARLE_H__
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <string.h>
+#include "tgastream.h"
+#include "tgarle.h"
+
+static const size_t flush_bytes = 1<<20;
+
+TGAStreamWriter::TGAStreamWriter() : used(0), width(0), height(0), bytespp(0), rle(true), rows_written(0) {
+}
+
+TGAStreamWriter::~TGAStreamWriter() {
+	if (out.is_open()) close();
+}
+
+bool TGAStreamWriter::open(const char *filename, int w, int h, int bpp, TGAImage::Origin origin, bool use_rle) {
+	if (w<=0 || h<=0 || w>65535 || h>65535 || (bpp!=TGAImage::GRAYSCALE && bpp!=TGAImage::RGB && bpp!=TGAImage::RGBA)) {
+		std::cerr << "bad bpp (or width/height) value\n";
+		return false;
+	}
+	out.open(filename, std::ios::binary);
+	if (!out.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	width = w;
+	height = h;
+	bytespp = bpp;
+	rle = use_rle;
+	rows_written = 0;
+	used = 0;
+	buffer.resize(flush_bytes+tga_rle_bound(w, bpp));
+
+	TGA_Header header;
+	memset((void *)&header, 0, sizeof(header));
+	header.bitsperpixel = bytespp<<3;
+	header.width  = width;
+	header.height = height;
+	header.datatypecode = (bytespp==TGAImage::GRAYSCALE?(rle?11:3):(rle?10:2));
+	header.imagedescriptor = (TGAImage::TOP_LEFT==origin ? 0x20 : 0x00);
+	out.write((char *)&header, sizeof(header));
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
+	return true;
+}
+
+bool TGAStreamWriter::flush() {
+	if (!used) return true;
+	out.write((char *)buffer.data(), used);
+	used = 0;
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
+	return true;
+}
+
+bool TGAStreamWriter::write_row(const unsigned char *row) {
+	if (!out.is_open() || rows_written>=height) return false;
+	if (rle) {
+		used += tga_rle_encode(row, width, bytespp, buffer.data()+used);
+	} else {
+		memcpy(buffer.data()+used, row, (size_t)width*bytespp);
+		used += (size_t)width*bytespp;
+	}
+	rows_written++;
+	return used<flush_bytes || flush();
+}
+
+bool TGAStreamWriter::close() {
+	if (!out.is_open()) return false;
+	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
+	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
+	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+	bool ok = flush();
+	if (rows_written!=height) {
+		std::cerr << "tga stream closed after " << rows_written << " of " << height << " rows\n";
+		ok = false;
+	}
+	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+	out.write((char *)footer, sizeof(footer));
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		ok = false;
+	}
+	out.close();
+	return ok;
+}
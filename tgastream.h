@@ -0,0 +1,31 @@
+#ifndef __TGASTREAM_H__
+#define __TGASTREAM_H__
+
+#include <fstream>
+#include <vector>
+#include "tgaimage.h"
+
+// Writes a TGA file row by row, so the whole image never has to exist in memory.
+// RLE packets are limited to one scanline; encoded rows collect in a buffer that
+// goes to disk in large writes.
+class TGAStreamWriter {
+	std::ofstream out;
+	std::vector<unsigned char> buffer;
+	size_t used;
+	int width;
+	int height;
+	int bytespp;
+	bool rle;
+	int rows_written;
+
+	bool flush();
+public:
+	TGAStreamWriter();
+	~TGAStreamWriter();
+	bool open(const char *filename, int w, int h, int bpp, TGAImage::Origin origin, bool rle=true);
+	bool write_row(const unsigned char *row); // w pixels in the file's format, in file row order
+	bool close(); // false if rows are missing or a write failed
+	int rows_left() const { return height-rows_written; }
+};
+
+#endif //__TGASTREAM_H__
@@ -0,0 +1,45 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(unsigned nthreads) : stopping(false) {
+	if (!nthreads) nthreads = std::thread::hardware_concurrency();
+	if (!nthreads) nthreads = 1;
+	for (unsigned i=0; i<nthreads; i++)
+		workers.push_back(std::thread(&ThreadPool::run, this));
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+	}
+	cv.notify_all();
+	for (size_t i=0; i<workers.size(); i++)
+		workers[i].join();
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		tasks.push_back(std::move(task));
+	}
+	cv.notify_one();
+}
+
+void ThreadPool::run() {
+	for (;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			cv.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (tasks.empty()) return; // stopping and drained
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
+
+ThreadPool &ThreadPool::shared() {
+	static ThreadPool pool;
+	return pool;
+}
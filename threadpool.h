@@ -0,0 +1,83 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+
+// Fixed set of worker threads pulling tasks from one queue.
+class ThreadPool {
+	std::vector<std::thread> workers;
+	std::deque<std::function<void()> > tasks;
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool stopping;
+
+	void run();
+public:
+	explicit ThreadPool(unsigned nthreads=0); // 0 = one per hardware thread
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator =(const ThreadPool &) = delete;
+	~ThreadPool();
+
+	unsigned size() const { return (unsigned)workers.size(); }
+	void enqueue(std::function<void()> task);
+
+	template <class F> std::future<decltype(std::declval<F>()())> submit(F &&f) {
+		typedef decltype(f()) R;
+		std::shared_ptr<std::packaged_task<R()> > task = std::make_shared<std::packaged_task<R()> >(std::forward<F>(f));
+		std::future<R> result = task->get_future();
+		enqueue([task]() { (*task)(); });
+		return result;
+	}
+
+	// Calls f(begin, end) over [0, n) in chunks of grain items. The caller works on chunks
+	// too and only waits for chunks other threads already started, so it is safe to call
+	// from inside a pool task.
+	template <class F> void parallel_for(size_t n, size_t grain, F f) {
+		if (!grain) grain = 1;
+		size_t nchunks = (n+grain-1)/grain;
+		if (nchunks<=1 || workers.empty()) {
+			if (n) f(0, n);
+			return;
+		}
+		struct State {
+			std::atomic<size_t> next;
+			std::atomic<size_t> done;
+			std::mutex mtx;
+			std::condition_variable cv;
+		};
+		std::shared_ptr<State> st = std::make_shared<State>();
+		st->next = 0;
+		st->done = 0;
+		F *fn = &f;
+		std::function<void()> work = [st, fn, n, grain, nchunks]() {
+			size_t chunk;
+			while ((chunk = st->next++)<nchunks) {
+				size_t begin = chunk*grain;
+				size_t end = begin+grain<n ? begin+grain : n;
+				(*fn)(begin, end);
+				if (++st->done==nchunks) {
+					std::lock_guard<std::mutex> lock(st->mtx);
+					st->cv.notify_all();
+				}
+			}
+		};
+		size_t helpers = nchunks-1<workers.size() ? nchunks-1 : workers.size();
+		for (size_t i=0; i<helpers; i++)
+			enqueue(work);
+		work();
+		std::unique_lock<std::mutex> lock(st->mtx);
+		st->cv.wait(lock, [&]() { return st->done==nchunks; });
+	}
+
+	static ThreadPool &shared(); // process-wide pool, created on first use
+};
+
+#endif //__THREADPOOL_H__